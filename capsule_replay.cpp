@@ -0,0 +1,159 @@
+// Deterministic replay of recorded planning problems.
+//
+// Usage: capsule_replay [--threads <t>] [--repeat <k>] <capsule or directory>...
+//
+// Capsules are written by GCOPTER_PolytopeSFC::saveCapsule while recording
+// is on. Directories are scanned for *.gcap files. Every capsule is solved
+// k times on a PlannerPool with its recorded seed, and one line per capsule
+// reports the status, the cost, whether all repeats agreed, and the
+// setup / optimize latencies. Run with --threads 1 under perf to profile
+// a single problem in a loop.
+//
+// Recorded budgets, anytime settings and the vertex cache capacity are
+// applied again, and a solve that was canceled stops at the same
+// iteration. A budget is counted from the start of optimize, as it was
+// recorded. It stops at a wall-clock time, so repeats of a solve that
+// ran into it need not agree.
+
+#include "problem_capsule.hpp"
+#include "planner_pool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace replay
+{
+
+    inline planner_pool::PlanRequest toRequest(const problem_capsule::ProblemCapsule &cap)
+    {
+        planner_pool::PlanRequest req;
+        req.timeWeight = cap.timeWeight;
+        req.headPVA = cap.headPVA;
+        req.tailPVA = cap.tailPVA;
+        req.corridor = cap.corridor;
+        req.lengthPerPiece = cap.lengthPerPiece;
+        req.smoothingFactor = cap.smoothingFactor;
+        req.integralResolution = cap.integralResolution;
+        req.magnitudeBounds = cap.magnitudeBounds;
+        req.penaltyWeights = cap.penaltyWeights;
+        req.physicalParams = cap.physicalParams;
+        req.relCostTol = cap.relCostTol;
+        req.timeBudget = cap.timeBudget;
+        req.stopIteration = cap.stopIteration;
+        req.anytime = cap.anytime;
+        req.anytimeParams.timeBudget = cap.timeBudget;
+        req.anytimeParams.relCostTol = cap.relCostTol;
+        req.anytimeParams.velSlack = cap.velSlack;
+        req.anytimeParams.corridorSlack = cap.corridorSlack;
+        req.anytimeParams.checkResolution = cap.checkResolution;
+        req.anytimeParams.escalateResolution = cap.escalateResolution;
+        req.anytimeParams.initialResolution = cap.initialResolution;
+        req.randSeed = cap.randSeed;
+        req.boxCorridor = cap.boxCorridor;
+        req.vertexCacheCapacity = cap.vertexCacheCapacity;
+        req.otherAgents = cap.otherAgents;
+        req.swarmThreshold = cap.swarmThreshold;
+        req.swarmEllipsoid = cap.swarmEllipsoid;
+        return req;
+    }
+
+    inline double median(std::vector<double> v)
+    {
+        std::sort(v.begin(), v.end());
+        return v[v.size() / 2];
+    }
+
+}
+
+int main(int argc, char **argv)
+{
+    int threads = 0;
+    int repeat = 1;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            threads = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+        {
+            repeat = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (std::filesystem::is_directory(argv[i]))
+        {
+            std::vector<std::string> found;
+            for (const auto &entry : std::filesystem::directory_iterator(argv[i]))
+            {
+                if (entry.is_regular_file() && entry.path().extension() == ".gcap")
+                {
+                    found.push_back(entry.path().string());
+                }
+            }
+            std::sort(found.begin(), found.end());
+            files.insert(files.end(), found.begin(), found.end());
+        }
+        else if (argv[i][0] != '-')
+        {
+            files.push_back(argv[i]);
+        }
+        else
+        {
+            std::fprintf(stderr, "Usage: %s [--threads <t>] [--repeat <k>] <capsule or directory>...\n", argv[0]);
+            return 1;
+        }
+    }
+    if (files.empty())
+    {
+        std::fprintf(stderr, "No capsules given\n");
+        return 1;
+    }
+
+    std::vector<std::string> names;
+    std::vector<planner_pool::PlanRequest> requests;
+    for (const std::string &file : files)
+    {
+        problem_capsule::ProblemCapsule cap;
+        if (problem_capsule::load(file, cap))
+        {
+            names.push_back(file);
+            const planner_pool::PlanRequest req = replay::toRequest(cap);
+            for (int k = 0; k < repeat; k++)
+            {
+                requests.push_back(req);
+            }
+        }
+    }
+
+    planner_pool::PlannerPool pool(threads);
+    std::vector<planner_pool::PlanResult> results;
+    pool.planAll(requests, results);
+
+    std::printf("%-40s %7s %14s %6s %6s %12s %12s\n",
+                "capsule", "status", "cost", "iters", "same", "setup_ms", "optimize_ms");
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        const planner_pool::PlanResult *res = &results[i * repeat];
+        bool same = true;
+        std::vector<double> setup, optimize;
+        for (int k = 0; k < repeat; k++)
+        {
+            same = same && res[k].status == res[0].status &&
+                   (res[k].cost == res[0].cost ||
+                    (std::isnan(res[k].cost) && std::isnan(res[0].cost)));
+            setup.push_back(1.0e3 * res[k].stats.setupTime);
+            optimize.push_back(1.0e3 * res[k].stats.optimizeTime);
+        }
+        std::printf("%-40s %7d %14.6f %6d %6s %12.4f %12.4f\n",
+                    names[i].c_str(), res[0].status, res[0].cost, res[0].stats.iterations,
+                    same ? "yes" : "no", replay::median(setup), replay::median(optimize));
+    }
+
+    return 0;
+}
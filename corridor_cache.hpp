@@ -0,0 +1,184 @@
+#ifndef CORRIDOR_CACHE_HPP
+#define CORRIDOR_CACHE_HPP
+
+#include <Eigen/Eigen>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <list>
+#include <unordered_map>
+
+namespace corridor_cache
+{
+
+    // splitmix64 finalizer
+    inline uint64_t mix(uint64_t x)
+    {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+
+    // Hash of the exact content of an H-polytope, combined with seed
+    inline uint64_t hashPolytope(const Eigen::MatrixX4d &hPoly,
+                                 const uint64_t seed = 0)
+    {
+        uint64_t h = mix(seed ^ (uint64_t)hPoly.rows());
+        uint64_t bits;
+        for (int i = 0; i < hPoly.size(); i++)
+        {
+            // Adding zero maps -0.0 to +0.0
+            const double v = hPoly.data()[i] + 0.0;
+            std::memcpy(&bits, &v, sizeof(bits));
+            h = mix(h ^ bits);
+        }
+        return h;
+    }
+
+    // LRU map from H-polytopes to their V-representation with a bound on
+    // the memory held. The tag names the state the V-representation was
+    // computed in, e.g. a random stream. Entries keep their H-polytope and
+    // tag so that a hash collision is detected and treated as a miss.
+    // Capacity of a VertexCache unless set otherwise
+    constexpr size_t defaultCapacity = 16u << 20;
+
+    class VertexCache
+    {
+    public:
+        explicit VertexCache(const size_t maxBytes = defaultCapacity)
+            : capacity(maxBytes), used(0), hitNum(0), missNum(0) {}
+
+        inline bool find(const uint64_t key,
+                         const uint64_t tag,
+                         const Eigen::MatrixX4d &hPoly,
+                         Eigen::Matrix3Xd &vPoly)
+        {
+            const auto it = index.find(key);
+            if (it == index.end() ||
+                it->second->tag != tag ||
+                it->second->hPoly.rows() != hPoly.rows() ||
+                it->second->hPoly != hPoly)
+            {
+                missNum++;
+                return false;
+            }
+            entries.splice(entries.begin(), entries, it->second);
+            vPoly = it->second->vPoly;
+            hitNum++;
+            return true;
+        }
+
+        inline void insert(const uint64_t key,
+                           const uint64_t tag,
+                           const Eigen::MatrixX4d &hPoly,
+                           const Eigen::Matrix3Xd &vPoly)
+        {
+            const size_t bytes = entryBytes(hPoly, vPoly);
+            if (bytes > capacity)
+            {
+                return;
+            }
+            const auto it = index.find(key);
+            if (it != index.end())
+            {
+                erase(it->second);
+            }
+            entries.push_front(Entry{key, tag, hPoly, vPoly, bytes});
+            index[key] = entries.begin();
+            used += bytes;
+            shrink(capacity);
+            return;
+        }
+
+        // A capacity of zero disables the cache
+        inline void setCapacity(const size_t maxBytes)
+        {
+            capacity = maxBytes;
+            shrink(capacity);
+            return;
+        }
+
+        inline void clear()
+        {
+            shrink(0);
+            hitNum = 0;
+            missNum = 0;
+            return;
+        }
+
+        inline size_t size() const
+        {
+            return entries.size();
+        }
+
+        inline size_t bytes() const
+        {
+            return used;
+        }
+
+        inline size_t getCapacity() const
+        {
+            return capacity;
+        }
+
+        inline size_t hits() const
+        {
+            return hitNum;
+        }
+
+        inline size_t misses() const
+        {
+            return missNum;
+        }
+
+    private:
+        struct Entry
+        {
+            uint64_t key;
+            uint64_t tag;
+            Eigen::MatrixX4d hPoly;
+            Eigen::Matrix3Xd vPoly;
+            size_t bytes;
+        };
+
+        std::list<Entry> entries;
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+        size_t capacity;
+        size_t used;
+        size_t hitNum;
+        size_t missNum;
+
+        static inline size_t entryBytes(const Eigen::MatrixX4d &hPoly,
+                                        const Eigen::Matrix3Xd &vPoly)
+        {
+            // Payload plus list and hash nodes
+            return sizeof(Entry) + 4 * sizeof(void *) + 2 * sizeof(uint64_t) +
+                   sizeof(double) * (hPoly.size() + vPoly.size());
+        }
+
+        inline void erase(const std::list<Entry>::iterator &it)
+        {
+            used -= it->bytes;
+            index.erase(it->key);
+            entries.erase(it);
+            return;
+        }
+
+        inline void shrink(const size_t maxBytes)
+        {
+            while (used > maxBytes && !entries.empty())
+            {
+                erase(std::prev(entries.end()));
+            }
+            return;
+        }
+    };
+
+}
+
+#endif
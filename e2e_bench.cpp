@@ -0,0 +1,229 @@
+// End-to-end planning latency over randomized scenarios.
+//
+// Usage: e2e_bench [--count <n>] [--seed <s>] [--threads <t>]
+//                  [--corridor box|firi|mixed] [--agents <max>] [--budget <s>]
+//                  [--out <file.json>]
+//
+// Scenarios come from scenario_gen::ScenarioGenerator and are solved by
+// a PlannerPool with setup + optimize. With one thread (the default)
+// the latencies are those of sequential planning. A solve succeeds when
+// it converges to a trajectory that passes the feasibility check of
+// optimizeAnytime. Converged but infeasible solves, solves stopped at the
+// deadline and failed ones are counted apart. Latency and iteration
+// distributions of each group, the success rate and the status counts
+// are written as JSON to stdout or --out. The planner reports failures
+// on stdout too, so use --out when the JSON is parsed.
+
+#include "scenario_gen.hpp"
+#include "planner_pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace bench
+{
+
+    struct Distribution
+    {
+        double mean = 0.0;
+        double p50 = 0.0;
+        double p90 = 0.0;
+        double p99 = 0.0;
+        double max = 0.0;
+    };
+
+    inline Distribution distribution(std::vector<double> v)
+    {
+        Distribution d;
+        if (v.empty())
+        {
+            return d;
+        }
+        std::sort(v.begin(), v.end());
+        const int n = v.size();
+        for (const double x : v)
+        {
+            d.mean += x;
+        }
+        d.mean /= n;
+        const auto at = [&](const double q)
+        {
+            return v[std::min(n - 1, std::max(0, (int)std::ceil(q * n) - 1))];
+        };
+        d.p50 = at(0.50);
+        d.p90 = at(0.90);
+        d.p99 = at(0.99);
+        d.max = v.back();
+        return d;
+    }
+
+    inline void writeDistribution(std::FILE *fp,
+                                  const char *name,
+                                  const Distribution &d,
+                                  const bool last)
+    {
+        std::fprintf(fp,
+                     "      \"%s\": {\"mean\": %.4f, \"p50\": %.4f, \"p90\": %.4f, "
+                     "\"p99\": %.4f, \"max\": %.4f}%s\n",
+                     name, d.mean, d.p50, d.p90, d.p99, d.max, last ? "" : ",");
+        return;
+    }
+
+    // Latencies in milliseconds of one group of solves
+    struct Samples
+    {
+        std::vector<double> solve, setup, optimize, iterations;
+
+        inline void add(const planner_pool::PlanResult &res)
+        {
+            solve.push_back(1.0e3 * res.solveLatency);
+            setup.push_back(1.0e3 * res.stats.setupTime);
+            optimize.push_back(1.0e3 * res.stats.optimizeTime);
+            iterations.push_back(res.stats.iterations);
+            return;
+        }
+    };
+
+    inline void writeSamples(std::FILE *fp,
+                             const char *name,
+                             const Samples &s,
+                             const bool last)
+    {
+        std::fprintf(fp, "    \"%s\": {\n      \"count\": %d,\n", name, (int)s.solve.size());
+        writeDistribution(fp, "solve_ms", distribution(s.solve), false);
+        writeDistribution(fp, "setup_ms", distribution(s.setup), false);
+        writeDistribution(fp, "optimize_ms", distribution(s.optimize), false);
+        writeDistribution(fp, "iterations", distribution(s.iterations), true);
+        std::fprintf(fp, "    }%s\n", last ? "" : ",");
+        return;
+    }
+
+}
+
+int main(int argc, char **argv)
+{
+    int count = 1000;
+    uint64_t seed = 1;
+    int threads = 1;
+    double budget = 0.0;
+    std::string out;
+    scenario_gen::ScenarioParams params;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+        {
+            count = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+        {
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            threads = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--corridor") == 0 && i + 1 < argc)
+        {
+            const std::string type = argv[++i];
+            params.corridorType = type == "box"    ? scenario_gen::CORRIDOR_BOX_CHAIN
+                                  : type == "firi" ? scenario_gen::CORRIDOR_FIRI
+                                                   : scenario_gen::CORRIDOR_MIXED;
+        }
+        else if (std::strcmp(argv[i], "--agents") == 0 && i + 1 < argc)
+        {
+            params.maxAgents = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--budget") == 0 && i + 1 < argc)
+        {
+            budget = std::atof(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+        {
+            out = argv[++i];
+        }
+        else
+        {
+            std::fprintf(stderr,
+                         "Usage: %s [--count <n>] [--seed <s>] [--threads <t>] "
+                         "[--corridor box|firi|mixed] [--agents <max>] [--budget <s>] [--out <file.json>]\n",
+                         argv[0]);
+            return 1;
+        }
+    }
+
+    scenario_gen::ScenarioGenerator generator(seed, params);
+    std::vector<planner_pool::PlanRequest> requests(count);
+    for (int i = 0; i < count; i++)
+    {
+        requests[i] = generator.next();
+        requests[i].timeBudget = budget;
+    }
+
+    planner_pool::PlannerPool pool(threads);
+    std::vector<planner_pool::PlanResult> results;
+    const auto start = std::chrono::steady_clock::now();
+    pool.planAll(requests, results);
+    const double wall = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+
+    // Each group stops at a different point, so mixing them would say
+    // little about any of them
+    bench::Samples succeeded, infeasible, stopped, failed;
+    int statusCount[4] = {0, 0, 0, 0};
+    for (const planner_pool::PlanResult &res : results)
+    {
+        if (res.success)
+        {
+            succeeded.add(res);
+        }
+        else if (res.status == gcopter::OPTIMIZE_SUCCESS)
+        {
+            infeasible.add(res);
+        }
+        else if (res.status == gcopter::OPTIMIZE_FAILED)
+        {
+            failed.add(res);
+        }
+        else
+        {
+            stopped.add(res);
+        }
+        statusCount[std::min(3, res.status + 1)]++;
+    }
+    const int success = succeeded.solve.size();
+
+    std::FILE *fp = out.empty() ? stdout : std::fopen(out.c_str(), "w");
+    if (fp == nullptr)
+    {
+        std::fprintf(stderr, "Cannot open %s\n", out.c_str());
+        return 1;
+    }
+    std::fprintf(fp, "{\n");
+    std::fprintf(fp, "  \"scenarios\": %d,\n  \"seed\": %llu,\n  \"threads\": %d,\n",
+                 count, (unsigned long long)seed, pool.size());
+    std::fprintf(fp, "  \"wall_s\": %.4f,\n  \"success_rate\": %.4f,\n",
+                 wall, count > 0 ? (double)success / count : 0.0);
+    std::fprintf(fp, "  \"outcomes\": {\"success\": %d, \"infeasible\": %d, \"stopped\": %d, \"failed\": %d},\n",
+                 success, (int)infeasible.solve.size(), (int)stopped.solve.size(), (int)failed.solve.size());
+    std::fprintf(fp, "  \"status\": {\"success\": %d, \"canceled\": %d, \"deadline\": %d, \"failed\": %d},\n",
+                 statusCount[1], statusCount[2], statusCount[3], statusCount[0]);
+    std::fprintf(fp, "  \"distributions\": {\n");
+    bench::writeSamples(fp, "success", succeeded, false);
+    bench::writeSamples(fp, "infeasible", infeasible, false);
+    bench::writeSamples(fp, "stopped", stopped, false);
+    bench::writeSamples(fp, "failed", failed, true);
+    std::fprintf(fp, "  }\n}\n");
+    if (fp != stdout)
+    {
+        std::fclose(fp);
+    }
+
+    return 0;
+}
@@ -32,11 +32,13 @@
 
 #include <Eigen/Eigen>
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cfloat>
 #include <cmath>
+#include <random>
 #include <vector>
 
 namespace firi
@@ -83,78 +85,217 @@ namespace firi
         }
     }
 
-    inline double costMVIE(void *data,
-                           const Eigen::VectorXd &x,
-                           Eigen::VectorXd &grad)
+    // Solver of the maximum volume inscribed ellipsoid. Its buffers only
+    // grow with the number of constraints, so repeated solves reuse them.
+    class MVIE
     {
-        const int64_t *pM = (int64_t *)data;
-        const double *pSmoothEps = (double *)(pM + 1);
-        const double *pPenaltyWt = pSmoothEps + 1;
-        const double *pA = pPenaltyWt + 1;
-
-        const int M = *pM;
-        const double smoothEps = *pSmoothEps;
-        const double penaltyWt = *pPenaltyWt;
-        Eigen::Map<const Eigen::MatrixX3d> A(pA, M, 3);
-        Eigen::Map<const Eigen::Vector3d> p(x.data());
-        Eigen::Map<const Eigen::Vector3d> rtd(x.data() + 3);
-        Eigen::Map<const Eigen::Vector3d> cde(x.data() + 6);
-        Eigen::Map<Eigen::Vector3d> gdp(grad.data());
-        Eigen::Map<Eigen::Vector3d> gdrtd(grad.data() + 3);
-        Eigen::Map<Eigen::Vector3d> gdcde(grad.data() + 6);
-
-        double cost = 0;
-        gdp.setZero();
-        gdrtd.setZero();
-        gdcde.setZero();
-
-        Eigen::Matrix3d L;
-        L(0, 0) = rtd(0) * rtd(0) + DBL_EPSILON;
-        L(0, 1) = 0.0;
-        L(0, 2) = 0.0;
-        L(1, 0) = cde(0);
-        L(1, 1) = rtd(1) * rtd(1) + DBL_EPSILON;
-        L(1, 2) = 0.0;
-        L(2, 0) = cde(2);
-        L(2, 1) = cde(1);
-        L(2, 2) = rtd(2) * rtd(2) + DBL_EPSILON;
-
-        const Eigen::MatrixX3d AL = A * L;
-        const Eigen::VectorXd normAL = AL.rowwise().norm();
-        const Eigen::Matrix3Xd adjNormAL = (AL.array().colwise() / normAL.array()).transpose();
-        const Eigen::VectorXd consViola = (normAL + A * p).array() - 1.0;
-
-        double c, dc;
-        Eigen::Vector3d vec;
-        for (int i = 0; i < M; ++i)
+    public:
+        // Each row of hPoly is defined by h0, h1, h2, h3 as
+        // h0*x + h1*y + h2*z + h3 <= 0
+        // R, p, r are ALWAYS taken as the initial guess
+        // R is also assumed to be a rotation matrix
+        // The LP draws from gen, or the calling thread's engine when null
+        inline bool solve(const Eigen::MatrixX4d &hPoly,
+                          Eigen::Matrix3d &R,
+                          Eigen::Vector3d &p,
+                          Eigen::Vector3d &r,
+                          std::mt19937_64 *gen = nullptr)
         {
-            if (smoothedL1(smoothEps, consViola(i), c, dc))
+            // Find the deepest interior point
+            M = hPoly.rows();
+            if (Alp.rows() < M)
+            {
+                Alp.resize(M, 4);
+                blp.resize(M);
+                A.resize(3, M);
+            }
+            double hNorm;
+            for (int i = 0; i < M; ++i)
+            {
+                hNorm = sqrt(hPoly(i, 0) * hPoly(i, 0) +
+                             (hPoly(i, 1) * hPoly(i, 1) + hPoly(i, 2) * hPoly(i, 2)));
+                Alp(i, 0) = hPoly(i, 0) / hNorm;
+                Alp(i, 1) = hPoly(i, 1) / hNorm;
+                Alp(i, 2) = hPoly(i, 2) / hNorm;
+                Alp(i, 3) = 1.0;
+                blp(i) = -hPoly(i, 3) / hNorm;
+            }
+            Eigen::Vector4d clp, xlp;
+            clp.setZero();
+            clp(3) = -1.0;
+            const double maxdepth = -sdlp::linprog<4>(clp, Alp.topRows(M), blp.head(M), xlp,
+                                                      gen != nullptr ? *gen : sdlp::rand_engine());
+            if (!(maxdepth > 0.0) || std::isinf(maxdepth))
+            {
+                return false;
+            }
+            const Eigen::Vector3d interior = xlp.head<3>();
+
+            // Constraints scaled to a^T x <= 1 around the interior point,
+            // stored column by column for the cost evaluation
+            for (int i = 0; i < M; ++i)
+            {
+                const double depth = blp(i) - (Alp(i, 0) * interior(0) +
+                                               Alp(i, 1) * interior(1) +
+                                               Alp(i, 2) * interior(2));
+                A(0, i) = Alp(i, 0) / depth;
+                A(1, i) = Alp(i, 1) / depth;
+                A(2, i) = Alp(i, 2) / depth;
+            }
+
+            x.resize(9);
+            const Eigen::Matrix3d Q = R * (r.cwiseProduct(r)).asDiagonal() * R.transpose();
+            Eigen::Matrix3d L;
+            chol3d(Q, L);
+
+            x.head<3>() = p - interior;
+            x(3) = sqrt(L(0, 0));
+            x(4) = sqrt(L(1, 1));
+            x(5) = sqrt(L(2, 2));
+            x(6) = L(1, 0);
+            x(7) = L(2, 1);
+            x(8) = L(2, 0);
+
+            double minCost;
+            lbfgs::lbfgs_parameter_t paramsMVIE;
+            paramsMVIE.mem_size = 18;
+            paramsMVIE.g_epsilon = 0.0;
+            paramsMVIE.min_step = 1.0e-32;
+            paramsMVIE.past = 3;
+            paramsMVIE.delta = 1.0e-7;
+            smoothEps = 1.0e-2;
+            penaltyWt = 1.0e+3;
+
+            int ret = lbfgs::lbfgs_optimize(x,
+                                            minCost,
+                                            &MVIE::costMVIE,
+                                            nullptr,
+                                            nullptr,
+                                            this,
+                                            paramsMVIE,
+                                            work);
+
+            if (ret < 0)
+            {
+                printf("FIRI WARNING: %s\n", lbfgs::lbfgs_strerror(ret));
+            }
+
+            p = x.head<3>() + interior;
+            L(0, 0) = x(3) * x(3);
+            L(0, 1) = 0.0;
+            L(0, 2) = 0.0;
+            L(1, 0) = x(6);
+            L(1, 1) = x(4) * x(4);
+            L(1, 2) = 0.0;
+            L(2, 0) = x(8);
+            L(2, 1) = x(7);
+            L(2, 2) = x(5) * x(5);
+            Eigen::JacobiSVD<Eigen::Matrix3d, Eigen::FullPivHouseholderQRPreconditioner> svd(L, Eigen::ComputeFullU);
+            const Eigen::Matrix3d U = svd.matrixU();
+            const Eigen::Vector3d S = svd.singularValues();
+            if (U.determinant() < 0.0)
+            {
+                R.col(0) = U.col(1);
+                R.col(1) = U.col(0);
+                R.col(2) = U.col(2);
+                r(0) = S(1);
+                r(1) = S(0);
+                r(2) = S(2);
+            }
+            else
             {
-                cost += c;
-                vec = dc * A.row(i).transpose();
-                gdp += vec;
-                gdrtd += adjNormAL.col(i).cwiseProduct(vec);
-                gdcde(0) += adjNormAL(0, i) * vec(1);
-                gdcde(1) += adjNormAL(1, i) * vec(2);
-                gdcde(2) += adjNormAL(0, i) * vec(2);
+                R = U;
+                r = S;
             }
+
+            return ret >= 0;
         }
-        cost *= penaltyWt;
-        gdp *= penaltyWt;
-        gdrtd *= penaltyWt;
-        gdcde *= penaltyWt;
 
-        cost -= log(L(0, 0)) + log(L(1, 1)) + log(L(2, 2));
-        gdrtd(0) -= 1.0 / L(0, 0);
-        gdrtd(1) -= 1.0 / L(1, 1);
-        gdrtd(2) -= 1.0 / L(2, 2);
+    private:
+        int M = 0;
+        double smoothEps = 0.0;
+        double penaltyWt = 0.0;
+        Eigen::MatrixX4d Alp;
+        Eigen::VectorXd blp;
+        Eigen::Matrix3Xd A;
+        Eigen::VectorXd x;
+        lbfgs::lbfgs_workspace_t work;
+
+        // One pass over the constraints computes A L, its row norms and
+        // the violations in place, which leaves nothing to allocate
+        static inline double costMVIE(void *data,
+                                      const Eigen::VectorXd &x,
+                                      Eigen::VectorXd &grad)
+        {
+            const MVIE &obj = *(const MVIE *)data;
+            const int M = obj.M;
+            const double smoothEps = obj.smoothEps;
+            const double penaltyWt = obj.penaltyWt;
+            Eigen::Map<const Eigen::Vector3d> p(x.data());
+            Eigen::Map<const Eigen::Vector3d> rtd(x.data() + 3);
+            Eigen::Map<const Eigen::Vector3d> cde(x.data() + 6);
+            Eigen::Map<Eigen::Vector3d> gdp(grad.data());
+            Eigen::Map<Eigen::Vector3d> gdrtd(grad.data() + 3);
+            Eigen::Map<Eigen::Vector3d> gdcde(grad.data() + 6);
+
+            double cost = 0;
+            gdp.setZero();
+            gdrtd.setZero();
+            gdcde.setZero();
+
+            const double l00 = rtd(0) * rtd(0) + DBL_EPSILON;
+            const double l11 = rtd(1) * rtd(1) + DBL_EPSILON;
+            const double l22 = rtd(2) * rtd(2) + DBL_EPSILON;
+            const double l10 = cde(0);
+            const double l21 = cde(1);
+            const double l20 = cde(2);
+
+            double c, dc, al0, al1, al2, normAL, consViola;
+            Eigen::Vector3d vec, adjNormAL;
+            for (int i = 0; i < M; ++i)
+            {
+                const double a0 = obj.A(0, i);
+                const double a1 = obj.A(1, i);
+                const double a2 = obj.A(2, i);
+                al0 = a0 * l00 + a1 * l10 + a2 * l20;
+                al1 = a1 * l11 + a2 * l21;
+                al2 = a2 * l22;
+                // Summed in the order of Eigen's rowwise().norm()
+                normAL = sqrt(al0 * al0 + (al1 * al1 + al2 * al2));
+                consViola = (normAL + (a0 * p(0) + a1 * p(1) + a2 * p(2))) - 1.0;
+                if (smoothedL1(smoothEps, consViola, c, dc))
+                {
+                    cost += c;
+                    vec(0) = dc * a0;
+                    vec(1) = dc * a1;
+                    vec(2) = dc * a2;
+                    adjNormAL(0) = al0 / normAL;
+                    adjNormAL(1) = al1 / normAL;
+                    adjNormAL(2) = al2 / normAL;
+                    gdp += vec;
+                    gdrtd += adjNormAL.cwiseProduct(vec);
+                    gdcde(0) += adjNormAL(0) * vec(1);
+                    gdcde(1) += adjNormAL(1) * vec(2);
+                    gdcde(2) += adjNormAL(0) * vec(2);
+                }
+            }
+            cost *= penaltyWt;
+            gdp *= penaltyWt;
+            gdrtd *= penaltyWt;
+            gdcde *= penaltyWt;
+
+            cost -= log(l00) + log(l11) + log(l22);
+            gdrtd(0) -= 1.0 / l00;
+            gdrtd(1) -= 1.0 / l11;
+            gdrtd(2) -= 1.0 / l22;
 
-        gdrtd(0) *= 2.0 * rtd(0);
-        gdrtd(1) *= 2.0 * rtd(1);
-        gdrtd(2) *= 2.0 * rtd(2);
+            gdrtd(0) *= 2.0 * rtd(0);
+            gdrtd(1) *= 2.0 * rtd(1);
+            gdrtd(2) *= 2.0 * rtd(2);
 
-        return cost;
-    }
+            return cost;
+        }
+    };
 
     // Each row of hPoly is defined by h0, h1, h2, h3 as
     // h0*x + h1*y + h2*z + h3 <= 0
@@ -163,120 +304,35 @@ namespace firi
     inline bool maxVolInsEllipsoid(const Eigen::MatrixX4d &hPoly,
                                    Eigen::Matrix3d &R,
                                    Eigen::Vector3d &p,
-                                   Eigen::Vector3d &r)
+                                   Eigen::Vector3d &r,
+                                   std::mt19937_64 *gen = nullptr)
     {
-        // Find the deepest interior point
-        const int M = hPoly.rows();
-        Eigen::MatrixX4d Alp(M, 4);
-        Eigen::VectorXd blp(M);
-        Eigen::Vector4d clp, xlp;
-        const Eigen::ArrayXd hNorm = hPoly.leftCols<3>().rowwise().norm();
-        Alp.leftCols<3>() = hPoly.leftCols<3>().array().colwise() / hNorm;
-        Alp.rightCols<1>().setConstant(1.0);
-        blp = -hPoly.rightCols<1>().array() / hNorm;
-        clp.setZero();
-        clp(3) = -1.0;
-        const double maxdepth = -sdlp::linprog<4>(clp, Alp, blp, xlp);
-        if (!(maxdepth > 0.0) || std::isinf(maxdepth))
-        {
-            return false;
-        }
-        const Eigen::Vector3d interior = xlp.head<3>();
-
-        // Prepare the data for MVIE optimization
-        uint8_t *optData = new uint8_t[sizeof(int64_t) + (2 + 3 * M) * sizeof(double)];
-        int64_t *pM = (int64_t *)optData;
-        double *pSmoothEps = (double *)(pM + 1);
-        double *pPenaltyWt = pSmoothEps + 1;
-        double *pA = pPenaltyWt + 1;
-
-        *pM = M;
-        Eigen::Map<Eigen::MatrixX3d> A(pA, M, 3);
-        A = Alp.leftCols<3>().array().colwise() /
-            (blp - Alp.leftCols<3>() * interior).array();
-
-        Eigen::VectorXd x(9);
-        const Eigen::Matrix3d Q = R * (r.cwiseProduct(r)).asDiagonal() * R.transpose();
-        Eigen::Matrix3d L;
-        chol3d(Q, L);
-
-        x.head<3>() = p - interior;
-        x(3) = sqrt(L(0, 0));
-        x(4) = sqrt(L(1, 1));
-        x(5) = sqrt(L(2, 2));
-        x(6) = L(1, 0);
-        x(7) = L(2, 1);
-        x(8) = L(2, 0);
-
-        double minCost;
-        lbfgs::lbfgs_parameter_t paramsMVIE;
-        paramsMVIE.mem_size = 18;
-        paramsMVIE.g_epsilon = 0.0;
-        paramsMVIE.min_step = 1.0e-32;
-        paramsMVIE.past = 3;
-        paramsMVIE.delta = 1.0e-7;
-        *pSmoothEps = 1.0e-2;
-        *pPenaltyWt = 1.0e+3;
-
-        int ret = lbfgs::lbfgs_optimize(x,
-                                        minCost,
-                                        &costMVIE,
-                                        nullptr,
-                                        nullptr,
-                                        optData,
-                                        paramsMVIE);
-
-        if (ret < 0)
-        {
-            printf("FIRI WARNING: %s\n", lbfgs::lbfgs_strerror(ret));
-        }
-
-        p = x.head<3>() + interior;
-        L(0, 0) = x(3) * x(3);
-        L(0, 1) = 0.0;
-        L(0, 2) = 0.0;
-        L(1, 0) = x(6);
-        L(1, 1) = x(4) * x(4);
-        L(1, 2) = 0.0;
-        L(2, 0) = x(8);
-        L(2, 1) = x(7);
-        L(2, 2) = x(5) * x(5);
-        Eigen::JacobiSVD<Eigen::Matrix3d, Eigen::FullPivHouseholderQRPreconditioner> svd(L, Eigen::ComputeFullU);
-        const Eigen::Matrix3d U = svd.matrixU();
-        const Eigen::Vector3d S = svd.singularValues();
-        if (U.determinant() < 0.0)
-        {
-            R.col(0) = U.col(1);
-            R.col(1) = U.col(0);
-            R.col(2) = U.col(2);
-            r(0) = S(1);
-            r(1) = S(0);
-            r(2) = S(2);
-        }
-        else
-        {
-            R = U;
-            r = S;
-        }
-
-        delete[] optData;
-
-        return ret >= 0;
+        thread_local MVIE mvie;
+        return mvie.solve(hPoly, R, p, r, gen);
     }
 
+    // FIRI iterations from the initial ellipsoid {R diag(r) x + p : |x| <= 1},
+    // which is replaced by the one the returned polytope was grown from
+    // pc is taken by Ref so that maps of point buffers are not copied
+    // The LPs draw from gen, or the calling thread's engine when null
     inline bool firi(const Eigen::MatrixX4d &bd,
-                     const Eigen::Matrix3Xd &pc,
+                     const Eigen::Ref<const Eigen::Matrix3Xd> &pc,
                      const Eigen::Vector3d &a,
                      const Eigen::Vector3d &b,
+                     Eigen::Matrix3d &R,
+                     Eigen::Vector3d &p,
+                     Eigen::Vector3d &r,
                      Eigen::MatrixX4d &hPoly,
                      const int iterations = 4,
-                     const double epsilon = 1.0e-6)
+                     const double epsilon = 1.0e-6,
+                     std::mt19937_64 *gen = nullptr)
     {
         const Eigen::Vector4d ah(a(0), a(1), a(2), 1.0);
         const Eigen::Vector4d bh(b(0), b(1), b(2), 1.0);
 
-        if ((bd * ah).maxCoeff() > 0.0 ||
-            (bd * bh).maxCoeff() > 0.0)
+        // Lazy products need no heap temporary for the dynamic row count
+        if (bd.lazyProduct(ah).maxCoeff() > 0.0 ||
+            bd.lazyProduct(bh).maxCoeff() > 0.0)
         {
             return false;
         }
@@ -284,12 +340,15 @@ namespace firi
         const int M = bd.rows();
         const int N = pc.cols();
 
-        Eigen::Matrix3d R = Eigen::Matrix3d::Identity();
-        Eigen::Vector3d p = 0.5 * (a + b);
-        Eigen::Vector3d r = Eigen::Vector3d::Ones();
         Eigen::MatrixX4d forwardH(M + N, 4);
         int nH = 0;
 
+        // Point coordinates in the ellipsoid frame, one array per axis
+        Eigen::ArrayXd X(N), Y(N), Z(N), D(N);
+        Eigen::Array<bool, -1, 1> fixup(N);
+        // Points not yet cut off by a selected plane
+        std::vector<int> order(N);
+
         for (int loop = 0; loop < iterations; ++loop)
         {
             const Eigen::Matrix3d forward = r.cwiseInverse().asDiagonal() * R.transpose();
@@ -304,11 +363,32 @@ namespace firi
             Eigen::MatrixX4d tangents(N, 4);
             Eigen::VectorXd distRs(N);
 
+            // Tangent planes of the unit sphere through every point, as a
+            // branch-free pass over the coordinate arrays. Operations are
+            // ordered as in the per-point code so the planes are identical.
+            X = forwardPC.row(0).transpose();
+            Y = forwardPC.row(1).transpose();
+            Z = forwardPC.row(2).transpose();
+            D = ((X * X + Y * Y) + Z * Z).sqrt();
+            tangents.col(0).array() = X / D;
+            tangents.col(1).array() = Y / D;
+            tangents.col(2).array() = Z / D;
+            tangents.col(3).array() = -D;
+            distRs.array() = D;
+            fixup = ((tangents.col(0).array() * fwd_a(0) + tangents.col(1).array() * fwd_a(1)) +
+                         tangents.col(2).array() * fwd_a(2) + tangents.col(3).array() >
+                     epsilon) ||
+                    ((tangents.col(0).array() * fwd_b(0) + tangents.col(1).array() * fwd_b(1)) +
+                         tangents.col(2).array() * fwd_b(2) + tangents.col(3).array() >
+                     epsilon);
+
+            // Planes cutting off a or b are fixed one by one, they are few
             for (int i = 0; i < N; i++)
             {
-                distRs(i) = forwardPC.col(i).norm();
-                tangents(i, 3) = -distRs(i);
-                tangents.block<1, 3>(i, 0) = forwardPC.col(i).transpose() / distRs(i);
+                if (!fixup(i))
+                {
+                    continue;
+                }
                 if (tangents.block<1, 3>(i, 0).dot(fwd_a) + tangents(i, 3) > epsilon)
                 {
                     const Eigen::Vector3d delta = forwardPC.col(i) - fwd_a;
@@ -333,21 +413,40 @@ namespace firi
                 }
             }
 
+            // Greedy selection of the closest remaining plane. The points
+            // not yet cut off are kept in a compacted list in index order:
+            // every new plane drops the points it cuts off in the same pass
+            // that finds the next closest one, so the work shrinks with the
+            // list instead of rescanning flags over all points. Sorting
+            // the points by distance up front would only add N log N work,
+            // since the cut test has to visit every remaining point anyway.
             Eigen::Matrix<uint8_t, -1, 1> bdFlags = Eigen::Matrix<uint8_t, -1, 1>::Constant(M, 1);
-            Eigen::Matrix<uint8_t, -1, 1> pcFlags = Eigen::Matrix<uint8_t, -1, 1>::Constant(N, 1);
+            int pcNum = 0;
+            for (int i = 0; i < N; i++)
+            {
+                if (!std::isnan(distRs(i)))
+                {
+                    order[pcNum++] = i;
+                }
+            }
 
             nH = 0;
 
             bool completed = false;
-            int bdMinId = 0, pcMinId = 0;
+            int bdMinId = 0, pcMinId = -1;
             double minSqrD = distDs.minCoeff(&bdMinId);
             double minSqrR = INFINITY;
-            if (distRs.size() != 0)
+            for (int k = 0; k < pcNum; ++k)
             {
-                minSqrR = distRs.minCoeff(&pcMinId);
+                if (minSqrR > distRs(order[k]))
+                {
+                    pcMinId = order[k];
+                    minSqrR = distRs(pcMinId);
+                }
             }
             for (int i = 0; !completed && i < (M + N); ++i)
             {
+                int picked = -1;
                 if (minSqrD < minSqrR)
                 {
                     forwardH.block<1, 3>(nH, 0) = forwardB.row(bdMinId);
@@ -357,7 +456,7 @@ namespace firi
                 else
                 {
                     forwardH.row(nH) = tangents.row(pcMinId);
-                    pcFlags(pcMinId) = 0;
+                    picked = pcMinId;
                 }
 
                 completed = true;
@@ -374,26 +473,26 @@ namespace firi
                         }
                     }
                 }
+
+                const double h0 = forwardH(nH, 0), h1 = forwardH(nH, 1);
+                const double h2 = forwardH(nH, 2), h3 = forwardH(nH, 3);
+                int kept = 0;
                 minSqrR = INFINITY;
-                for (int j = 0; j < N; ++j)
+                for (int k = 0; k < pcNum; ++k)
                 {
-                    if (pcFlags(j))
+                    const int j = order[k];
+                    if (j != picked && !((h0 * X(j) + h1 * Y(j)) + h2 * Z(j) + h3 > -epsilon))
                     {
-                        if (forwardH.block<1, 3>(nH, 0).dot(forwardPC.col(j)) + forwardH(nH, 3) > -epsilon)
-                        {
-                            pcFlags(j) = 0;
-                        }
-                        else
+                        order[kept++] = j;
+                        if (minSqrR > distRs(j))
                         {
-                            completed = false;
-                            if (minSqrR > distRs(j))
-                            {
-                                pcMinId = j;
-                                minSqrR = distRs(j);
-                            }
+                            pcMinId = j;
+                            minSqrR = distRs(j);
                         }
                     }
                 }
+                pcNum = kept;
+                completed = completed && pcNum == 0;
                 ++nH;
             }
 
@@ -409,12 +508,155 @@ namespace firi
                 break;
             }
 
-            maxVolInsEllipsoid(hPoly, R, p, r);
+            maxVolInsEllipsoid(hPoly, R, p, r, gen);
+        }
+
+        return true;
+    }
+
+    // pc is taken by Ref so that maps of point buffers are not copied
+    inline bool firi(const Eigen::MatrixX4d &bd,
+                     const Eigen::Ref<const Eigen::Matrix3Xd> &pc,
+                     const Eigen::Vector3d &a,
+                     const Eigen::Vector3d &b,
+                     Eigen::MatrixX4d &hPoly,
+                     const int iterations = 4,
+                     const double epsilon = 1.0e-6,
+                     std::mt19937_64 *gen = nullptr)
+    {
+        Eigen::Matrix3d R = Eigen::Matrix3d::Identity();
+        Eigen::Vector3d p = 0.5 * (a + b);
+        Eigen::Vector3d r = Eigen::Vector3d::Ones();
+        return firi(bd, pc, a, b, R, p, r, hPoly, iterations, epsilon, gen);
+    }
+
+    // True if a point of pc lies inside hPoly by more than epsilon. The
+    // points are taken eight at a time into a fixed-size block, whose
+    // largest halfspace values are kept per point, so nothing is
+    // allocated however many points or halfspaces there are.
+    inline bool anyInside(const Eigen::MatrixX4d &hPoly,
+                          const Eigen::Ref<const Eigen::Matrix3Xd> &pc,
+                          const double epsilon)
+    {
+        const int m = hPoly.rows();
+        const int n = pc.cols();
+        Eigen::Matrix<double, 8, 3> block;
+        Eigen::Matrix<double, 8, 1> maxDist;
+        for (int j = 0; j < n; j += 8)
+        {
+            const int w = std::min(8, n - j);
+            if (w == 8)
+            {
+                block = pc.middleCols<8>(j).transpose();
+            }
+            else
+            {
+                block.setZero();
+                block.topRows(w) = pc.middleCols(j, w).transpose();
+            }
+            maxDist.setConstant(-INFINITY);
+            for (int i = 0; i < m; i++)
+            {
+                maxDist = maxDist.cwiseMax(block * hPoly.block<1, 3>(i, 0).transpose() +
+                                           Eigen::Matrix<double, 8, 1>::Constant(hPoly(i, 3)));
+            }
+            if ((maxDist.head(w).array() < -epsilon).any())
+            {
+                return true;
+            }
         }
+        return false;
+    }
 
+    // Result of a firi call kept for the next replanning cycle
+    struct FiriState
+    {
+        bool valid = false;
+        bool reused = false;    // whether the last call kept hPoly as is
+        Eigen::Matrix3d R;
+        Eigen::Vector3d p;
+        Eigen::Vector3d r;
+        Eigen::MatrixX4d hPoly;
+    };
+
+    // True if hPoly lies within bd, checked by one LP per row of bd
+    // The LPs draw from gen, or the calling thread's engine when null
+    inline bool insideBox(const Eigen::MatrixX4d &hPoly,
+                          const Eigen::MatrixX4d &bd,
+                          const double epsilon,
+                          std::mt19937_64 *gen = nullptr)
+    {
+        std::mt19937_64 &engine = gen != nullptr ? *gen : sdlp::rand_engine();
+        const Eigen::MatrixX3d A = hPoly.leftCols<3>();
+        const Eigen::VectorXd b = -hPoly.rightCols<1>();
+        Eigen::Vector3d c, x;
+        for (int i = 0; i < bd.rows(); i++)
+        {
+            c = -bd.block<1, 3>(i, 0).transpose();
+            const double maxDist = -sdlp::linprog<3>(c, A, b, x, engine) + bd(i, 3);
+            if (!(maxDist <= epsilon))
+            {
+                return false;
+            }
+        }
         return true;
     }
 
+    // firi warm started from the previous cycle in state, which is updated.
+    // The previous polytope is returned unchanged when it still lies in bd,
+    // still contains a and b, and no point of pc is inside it by more than
+    // epsilon; points on its faces are the ones it was grown against.
+    // Otherwise the iterations start from the previous ellipsoid instead of
+    // the unit sphere at the segment midpoint.
+    // The LPs draw from gen, or the calling thread's engine when null
+    inline bool firi(const Eigen::MatrixX4d &bd,
+                     const Eigen::Ref<const Eigen::Matrix3Xd> &pc,
+                     const Eigen::Vector3d &a,
+                     const Eigen::Vector3d &b,
+                     FiriState &state,
+                     Eigen::MatrixX4d &hPoly,
+                     const int iterations = 4,
+                     const double epsilon = 1.0e-6,
+                     std::mt19937_64 *gen = nullptr)
+    {
+        state.reused = false;
+        if (state.valid)
+        {
+            const Eigen::Vector4d ah(a(0), a(1), a(2), 1.0);
+            const Eigen::Vector4d bh(b(0), b(1), b(2), 1.0);
+            const Eigen::MatrixX4d &prev = state.hPoly;
+            const bool keep = prev.lazyProduct(ah).maxCoeff() <= 0.0 &&
+                              prev.lazyProduct(bh).maxCoeff() <= 0.0 &&
+                              !anyInside(prev, pc, epsilon);
+            if (keep && insideBox(prev, bd, epsilon, gen))
+            {
+                hPoly = prev;
+                state.reused = true;
+                return true;
+            }
+
+            // A stale ellipsoid center outside the new box is of no use
+            const Eigen::Vector4d ph(state.p(0), state.p(1), state.p(2), 1.0);
+            if (bd.lazyProduct(ph).maxCoeff() >= 0.0)
+            {
+                state.valid = false;
+            }
+        }
+
+        if (!state.valid)
+        {
+            state.R = Eigen::Matrix3d::Identity();
+            state.p = 0.5 * (a + b);
+            state.r = Eigen::Vector3d::Ones();
+        }
+        state.valid = firi(bd, pc, a, b, state.R, state.p, state.r, hPoly, iterations, epsilon, gen);
+        if (state.valid)
+        {
+            state.hPoly = hPoly;
+        }
+        return state.valid;
+    }
+
 }
 
 #endif
@@ -28,17 +28,489 @@
 #include "minco.hpp"
 #include "flatness.hpp"
 #include "lbfgs.hpp"
+#include "problem_capsule.hpp"
+#include "corridor_cache.hpp"
+#include "thread_pool.hpp"
 #include "geo_utils.hpp"
 #include <Eigen/Eigen>
 
 #include <cmath>
+#include <atomic>
 #include <cfloat>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <iostream>
+#include <random>
+#include <string>
+#include <utility>
 #include <vector>
 
 namespace gcopter
 {
 
+    // Define GCOPTER_DISABLE_STATS to compile all instrumentation out
+#ifdef GCOPTER_DISABLE_STATS
+    constexpr bool enableStats = false;
+#else
+    constexpr bool enableStats = true;
+#endif
+
+    // Per-phase timings (in seconds) and counters of the last setup/optimize
+    struct PlannerStats
+    {
+        // setup
+        double processCorridorTime = 0.0;
+        double shortestPathTime = 0.0;
+        double setupTime = 0.0;
+        int vertexCacheHits = 0;
+        int vertexCacheMisses = 0;
+        int closedFormBoxes = 0;
+        int removedFaces = 0;
+
+        // optimize
+        double backwardPTime = 0.0;
+        double mincoTime = 0.0;
+        double penaltyTime = 0.0;
+        double swarmPenaltyTime = 0.0;
+        double adjointTime = 0.0;
+        double optimizeTime = 0.0;
+        int costEvaluations = 0;
+        int lineSearchTrials = 0;
+        int iterations = 0;
+
+        inline void resetOptimize()
+        {
+            backwardPTime = 0.0;
+            mincoTime = 0.0;
+            penaltyTime = 0.0;
+            swarmPenaltyTime = 0.0;
+            adjointTime = 0.0;
+            optimizeTime = 0.0;
+            costEvaluations = 0;
+            lineSearchTrials = 0;
+            iterations = 0;
+            return;
+        }
+    };
+
+    // Status of the last GCOPTER_PolytopeSFC::optimize call
+    enum
+    {
+        /* L-BFGS converged or met the relative cost tolerance */
+        OPTIMIZE_SUCCESS = 0,
+        /* stopped by the cancel token or the observer, best iterate returned */
+        OPTIMIZE_CANCELED,
+        /* stopped at the deadline, best iterate returned */
+        OPTIMIZE_DEADLINE,
+        /* L-BFGS failed, the trajectory is cleared */
+        OPTIMIZE_FAILED = -1,
+    };
+
+    // Progress of one L-BFGS iteration, as seen by the observer
+    struct IterationInfo
+    {
+        int iteration;
+        double cost;
+        double gradNorm;
+        double step;
+        // cost evaluations of this iteration's line search and in total
+        int evaluations;
+        int totalEvaluations;
+    };
+
+    // Optional monitoring and cooperative cancellation of optimize().
+    // The observer, token and deadline are checked between iterations;
+    // the observer returns false to stop the solve.
+    struct OptimizeControl
+    {
+        std::function<bool(const IterationInfo &)> observer;
+        const std::atomic<bool> *cancel = nullptr;
+        std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::time_point::max();
+
+        inline bool active() const
+        {
+            return observer || cancel != nullptr ||
+                   deadline != std::chrono::steady_clock::time_point::max();
+        }
+    };
+
+    // Settings of GCOPTER_PolytopeSFC::optimizeAnytime
+    struct AnytimeParams
+    {
+        // Wall-clock budget of the whole solve in seconds
+        double timeBudget = 0.008;
+        double relCostTol = 1.0e-4;
+        // Allowed excess over v_max and outside the corridor (in meters)
+        // for an iterate to still count as feasible
+        double velSlack = 0.0;
+        double corridorSlack = 1.0e-3;
+        // Samples per piece for the corridor check
+        int checkResolution = 8;
+        // Start from a coarse integral resolution and double it in
+        // stages until the one passed to setup is reached
+        bool escalateResolution = false;
+        int initialResolution = 2;
+    };
+
+    // Quality of the trajectory returned by optimizeAnytime
+    struct AnytimeReport
+    {
+        bool feasible = false;
+        double cost = INFINITY;
+        int iterations = 0;
+        int bestIteration = 0;
+        int stages = 0;
+        int finalResolution = 0;
+        double elapsed = 0.0;
+        double maxVelRate = 0.0;
+        // Largest signed distance outside the corridor, <= 0 when inside
+        double maxCorridorViolation = INFINITY;
+    };
+
+    // Lap timer that vanishes entirely when stats are disabled
+    class StatsClock
+    {
+    public:
+        StatsClock()
+        {
+            if (enableStats)
+            {
+                last = std::chrono::steady_clock::now();
+            }
+        }
+
+        // Adds the time since the previous lap to acc
+        inline void lap(double &acc)
+        {
+            if (enableStats)
+            {
+                const auto now = std::chrono::steady_clock::now();
+                acc += std::chrono::duration<double>(now - last).count();
+                last = now;
+            }
+            return;
+        }
+
+    private:
+        std::chrono::steady_clock::time_point last;
+    };
+
+    // The penalty kernels of the cost functional. Free functions so that
+    // the planner and the benchmarks run the same code.
+    namespace detail
+    {
+        // Faces of all corridor polytopes in a fixed-capacity SoA layout.
+        // Polytope i owns slots [i * capacity, (i + 1) * capacity), the
+        // first count(i) hold its faces and the rest never violate.
+        struct CorridorFaces
+        {
+            int capacity = 0;
+            Eigen::VectorXi count;
+            Eigen::VectorXd nx, ny, nz, d;
+        };
+
+        inline bool smoothedL1(const double &x,
+                               const double &mu,
+                               double &f,
+                               double &df)
+        {
+            if (x < 0.0)
+            {
+                return false;
+            }
+            else if (x > mu)
+            {
+                f = x - 0.5 * mu;
+                df = 1.0;
+                return true;
+            }
+            else
+            {
+                const double xdmu = x / mu;
+                const double sqrxdmu = xdmu * xdmu;
+                const double mumxd2 = mu - 0.5 * x;
+                f = mumxd2 * sqrxdmu * xdmu;
+                df = sqrxdmu * ((-0.5) * xdmu + 3.0 * mumxd2 / mu);
+                return true;
+            }
+        }
+
+        inline void getCorridorFaces(const std::vector<Eigen::MatrixX4d> &hPolys,
+                                     CorridorFaces &faces)
+        {
+            const int polyNum = hPolys.size();
+            int maxRows = 0;
+            for (int i = 0; i < polyNum; i++)
+            {
+                maxRows = std::max(maxRows, (int)hPolys[i].rows());
+            }
+            // Multiple of four so that every block starts 32 bytes apart
+            faces.capacity = (maxRows + 3) / 4 * 4;
+            faces.count.resize(polyNum);
+            faces.nx.setZero(polyNum * faces.capacity);
+            faces.ny.setZero(polyNum * faces.capacity);
+            faces.nz.setZero(polyNum * faces.capacity);
+            faces.d.setConstant(polyNum * faces.capacity, -1.0);
+            for (int i = 0; i < polyNum; i++)
+            {
+                const int m = hPolys[i].rows();
+                const int base = i * faces.capacity;
+                faces.count(i) = m;
+                faces.nx.segment(base, m) = hPolys[i].col(0);
+                faces.ny.segment(base, m) = hPolys[i].col(1);
+                faces.nz.segment(base, m) = hPolys[i].col(2);
+                faces.d.segment(base, m) = hPolys[i].col(3);
+            }
+            return;
+        }
+
+        // magnitudeBounds = [v_max, omg_max, theta_max, thrust_min, thrust_max]^T
+        // penaltyWeights = [pos_weight, vel_weight, omg_weight, theta_weight, thrust_weight]^T
+        // physicalParams = [vehicle_mass, gravitational_acceleration, horitonral_drag_coeff,
+        //                   vertical_drag_coeff, parasitic_drag_coeff, speed_smooth_factor]^T
+        inline void attachPenaltyFunctional(const Eigen::VectorXd &T,
+                                            const Eigen::MatrixX3d &coeffs,
+                                            const Eigen::VectorXi &hIdx,
+                                            const CorridorFaces &faces,
+                                            const double &smoothFactor,
+                                            const int &integralResolution,
+                                            const Eigen::VectorXd &magnitudeBounds,
+                                            const Eigen::VectorXd &penaltyWeights,
+                                            flatness::FlatnessMap &flatMap,
+                                            double &cost,
+                                            Eigen::VectorXd &gradT,
+                                            Eigen::MatrixX3d &gradC)
+        {
+            const double velSqrMax = magnitudeBounds(0) * magnitudeBounds(0);
+            const double omgSqrMax = magnitudeBounds(1) * magnitudeBounds(1);
+            const double thetaMax = magnitudeBounds(2);
+            const double thrustMean = 0.5 * (magnitudeBounds(3) + magnitudeBounds(4));
+            const double thrustRadi = 0.5 * fabs(magnitudeBounds(4) - magnitudeBounds(3));
+            const double thrustSqrRadi = thrustRadi * thrustRadi;
+
+            const double weightPos = penaltyWeights(0);
+            const double weightVel = penaltyWeights(1);
+            const double weightOmg = penaltyWeights(2);
+            const double weightTheta = penaltyWeights(3);
+            const double weightThrust = penaltyWeights(4);
+
+            Eigen::Vector3d pos, vel, acc, jer, sna;
+            Eigen::Vector3d totalGradPos, totalGradVel, totalGradAcc, totalGradJer;
+            double totalGradPsi, totalGradPsiD;
+            double thr, cos_theta;
+            Eigen::Vector4d quat;
+            Eigen::Vector3d omg;
+            double gradThr;
+            Eigen::Vector4d gradQuat;
+            Eigen::Vector3d gradPos, gradVel, gradOmg;
+
+            double step, alpha;
+            double s1, s2, s3, s4, s5;
+            Eigen::Matrix<double, 4, 1> beta0, beta1, beta2, beta3, beta4;
+            Eigen::Vector3d outerNormal;
+            int K, L;
+            double violaPos, violaVel, violaOmg, violaTheta, violaThrust;
+            double violaPosPenaD, violaVelPenaD, violaOmgPenaD, violaThetaPenaD, violaThrustPenaD;
+            double violaPosPena, violaVelPena, violaOmgPena, violaThetaPena, violaThrustPena;
+            double node, pena;
+
+            const int pieceNum = T.size();
+            const double integralFrac = 1.0 / integralResolution;
+            for (int i = 0; i < pieceNum; i++)
+            {
+                const Eigen::Matrix<double, 4, 3> &c = coeffs.block<4, 3>(i * 4, 0);
+                step = T(i) * integralFrac;
+                for (int j = 0; j <= integralResolution; j++)
+                {
+                    s1 = j * step;
+                    s2 = s1 * s1;
+                    s3 = s2 * s1;
+                    s4 = s2 * s2;
+                    s5 = s4 * s1;
+                    beta0(0) = 1.0, beta0(1) = s1, beta0(2) = s2, beta0(3) = s3;
+                    beta1(0) = 0.0, beta1(1) = 1.0, beta1(2) = 2.0 * s1, beta1(3) = 3.0 * s2;
+                    beta2(0) = 0.0, beta2(1) = 0.0, beta2(2) = 2.0, beta2(3) = 6.0 * s1;
+                    beta3(0) = 0.0, beta3(1) = 0.0, beta3(2) = 0.0, beta3(3) = 6.0;
+                    beta4(0) = 0.0, beta4(1) = 0.0, beta4(2) = 0.0, beta4(3) = 0.0;
+                    pos = c.transpose() * beta0;
+                    vel = c.transpose() * beta1;
+                    acc = c.transpose() * beta2;
+                    jer = c.transpose() * beta3;
+                    sna = c.transpose() * beta4;
+
+                    flatMap.forward(vel, acc, jer, 0.0, 0.0, thr, quat, omg);
+
+                    violaVel = vel.squaredNorm() - velSqrMax;
+                    violaOmg = omg.squaredNorm() - omgSqrMax;
+                    cos_theta = 1.0 - 2.0 * (quat(1) * quat(1) + quat(2) * quat(2));
+                    violaTheta = acos(cos_theta) - thetaMax;
+                    violaThrust = (thr - thrustMean) * (thr - thrustMean) - thrustSqrRadi;
+
+                    gradThr = 0.0;
+                    gradQuat.setZero();
+                    gradPos.setZero(), gradVel.setZero(), gradOmg.setZero();
+                    pena = 0.0;
+
+                    L = hIdx(i);
+                    // Each face value is read once, so none is stored
+                    const int base = L * faces.capacity;
+                    const double *nx = faces.nx.data() + base;
+                    const double *ny = faces.ny.data() + base;
+                    const double *nz = faces.nz.data() + base;
+                    const double *d = faces.d.data() + base;
+                    K = faces.count(L);
+                    for (int k = 0; k < K; k++)
+                    {
+                        violaPos = nx[k] * pos(0) + ny[k] * pos(1) + nz[k] * pos(2) + d[k];
+                        if (smoothedL1(violaPos, smoothFactor, violaPosPena, violaPosPenaD))
+                        {
+                            outerNormal << nx[k], ny[k], nz[k];
+                            gradPos += weightPos * violaPosPenaD * outerNormal;
+                            pena += weightPos * violaPosPena;
+                        }
+                    }
+
+                    if (smoothedL1(violaVel, smoothFactor, violaVelPena, violaVelPenaD))
+                    {
+                        gradVel += weightVel * violaVelPenaD * 2.0 * vel;
+                        pena += weightVel * violaVelPena;
+                    }
+
+                    if (smoothedL1(violaOmg, smoothFactor, violaOmgPena, violaOmgPenaD))
+                    {
+                        gradOmg += weightOmg * violaOmgPenaD * 2.0 * omg;
+                        pena += weightOmg * violaOmgPena;
+                    }
+
+                    if (smoothedL1(violaTheta, smoothFactor, violaThetaPena, violaThetaPenaD))
+                    {
+                        gradQuat += weightTheta * violaThetaPenaD /
+                                    sqrt(1.0 - cos_theta * cos_theta) * 4.0 *
+                                    Eigen::Vector4d(0.0, quat(1), quat(2), 0.0);
+                        pena += weightTheta * violaThetaPena;
+                    }
+
+                    if (smoothedL1(violaThrust, smoothFactor, violaThrustPena, violaThrustPenaD))
+                    {
+                        gradThr += weightThrust * violaThrustPenaD * 2.0 * (thr - thrustMean);
+                        pena += weightThrust * violaThrustPena;
+                    }
+
+                    flatMap.backward(gradPos, gradVel, gradThr, gradQuat, gradOmg,
+                                     totalGradPos, totalGradVel, totalGradAcc, totalGradJer,
+                                     totalGradPsi, totalGradPsiD);
+
+                    node = (j == 0 || j == integralResolution) ? 0.5 : 1.0;
+                    alpha = j * integralFrac;
+                    gradC.block<4, 3>(i * 4, 0) += (beta0 * totalGradPos.transpose() +
+                                                    beta1 * totalGradVel.transpose() +
+                                                    beta2 * totalGradAcc.transpose() +
+                                                    beta3 * totalGradJer.transpose()) *
+                                                   node * step;
+                    gradT(i) += (totalGradPos.dot(vel) +
+                                 totalGradVel.dot(acc) +
+                                 totalGradAcc.dot(jer) +
+                                 totalGradJer.dot(sna)) *
+                                    alpha * node * step +
+                                node * integralFrac * pena;
+                    cost += node * step * pena;
+                }
+            }
+
+            return;
+        }
+        // Swarm obstacle avoidance penalty: Eq. (26)-(30)
+        inline void attachSwarmPenaltyFunctional(
+            const Eigen::VectorXd &T,
+            const Eigen::MatrixX3d &coeffs,                 // trajectory coefficients
+            const Eigen::VectorXi &hIdx,                    // corridor indices
+            const std::vector<Eigen::MatrixX4d> &hPolys,    // safe corridor
+            double smoothFactor,
+            int integralResolution,
+            double swarmThreshold,                          // C_sw
+            Eigen::Matrix3d E,                              // ellipsoid matrix (usually diagonal)
+            const std::vector<Trajectory<3>> &otherAgents,  // all other agents' trajectories
+            double &cost,
+            Eigen::VectorXd &gradT,
+            Eigen::MatrixX3d &gradC
+        )
+        {
+            // Samples every sample_dt of global time, so that the other
+            // agents are always seen at the same instants, and once more at
+            // the end, weighted by the part of a step left before it. A
+            // sample never jumps, so the cost stays continuous in T.
+            const double sample_dt = 0.001;
+            const int pieceNum = T.size();
+            const double totalT = T.sum();
+            Eigen::Vector3d pos, vel, g;
+            for (const auto &other : otherAgents)
+            {
+                // The samples only move forward, and so does the piece of
+                // the other agent they fall in
+                const int otherNum = other.getPieceNum();
+                int j = 0;
+                double otherStart = 0.0;
+                double pieceStart = 0.0, lastT = 0.0;
+                for (int i = 0, k = 0; i < pieceNum && otherNum > 0; i++)
+                {
+                    const Eigen::Matrix<double, 4, 3> &c = coeffs.block<4, 3>(i * 4, 0);
+                    const double pieceEnd = pieceStart + T(i);
+                    const bool last = i == pieceNum - 1;
+                    double shiftGrad = 0.0;
+                    for (double t = k * sample_dt; t < pieceEnd || last; t = ++k * sample_dt)
+                    {
+                        double weight = 1.0;
+                        if (t >= totalT)
+                        {
+                            t = totalT;
+                            weight = (totalT - lastT) / sample_dt;
+                        }
+                        while (j < otherNum - 1 && t > otherStart + other[j].getDuration())
+                        {
+                            otherStart += other[j++].getDuration();
+                        }
+                        const double s1 = t - pieceStart;
+                        const double s2 = s1 * s1;
+                        pos = c.transpose() * Eigen::Vector4d(1.0, s1, s2, s2 * s1);
+                        const Eigen::Vector3d diff = pos - other[j].getPos(t - otherStart);
+                        const double violation = swarmThreshold * swarmThreshold - (E * diff).dot(diff);
+                        if (violation > 0.0) // Eq. (26)
+                        {
+                            g = -2.0 * weight * violation * (E + E.transpose()) * diff;
+                            cost += weight * violation * violation;
+                            gradC.row(i * 4 + 0) += g.transpose();
+                            gradC.row(i * 4 + 1) += s1 * g.transpose();
+                            gradC.row(i * 4 + 2) += s2 * g.transpose();
+                            gradC.row(i * 4 + 3) += s2 * s1 * g.transpose();
+                            vel = c.transpose() * Eigen::Vector4d(0.0, 1.0, 2.0 * s1, 3.0 * s2);
+                            if (t == totalT)
+                            {
+                                // The end sample moves with the total duration
+                                gradT(i) += g.dot(vel);
+                                gradT.array() += violation * violation / sample_dt -
+                                                 g.dot(other[j].getVel(t - otherStart));
+                            }
+                            else
+                            {
+                                shiftGrad += g.dot(vel);
+                            }
+                        }
+                        if (t == totalT)
+                        {
+                            break;
+                        }
+                        lastT = t;
+                    }
+                    // The samples of piece i move back when an earlier piece grows
+                    gradT.head(i).array() -= shiftGrad;
+                    pieceStart = pieceEnd;
+                }
+            }
+        }
+    }
+
     class GCOPTER_PolytopeSFC
     {
     public:
@@ -46,6 +518,7 @@ namespace gcopter
         typedef Eigen::MatrixX4d PolyhedronH;
         typedef std::vector<PolyhedronV> PolyhedraV;
         typedef std::vector<PolyhedronH> PolyhedraH;
+        typedef detail::CorridorFaces CorridorFaces;
 
     private:
         std::vector<Trajectory<3>> swarmOtherAgents;
@@ -61,6 +534,7 @@ namespace gcopter
 
         PolyhedraV vPolytopes;
         PolyhedraH hPolytopes;
+        CorridorFaces hFaces;
         Eigen::Matrix3Xd shortPath;
 
         Eigen::VectorXi pieceIdx;
@@ -81,6 +555,54 @@ namespace gcopter
         double allocSpeed;
 
         lbfgs::lbfgs_parameter_t lbfgs_params;
+        uint64_t randSeed = std::mt19937_64::default_seed;
+
+        PlannerStats stats;
+        const OptimizeControl *control = nullptr;
+        int totalEvaluations;
+        int status = OPTIMIZE_FAILED;
+
+        // Best feasible iterate tracked during optimizeAnytime
+        struct AnytimeState
+        {
+            const AnytimeParams *params;
+            Eigen::VectorXd bestX;
+            double bestCost;
+            bool found;
+            int stage;
+            int bestStage;
+            int iterations;
+            int bestIteration;
+        };
+        AnytimeState *anytime = nullptr;
+        Trajectory<3> checkTraj;
+
+        bool recording = false;
+        problem_capsule::ProblemCapsule capsule;
+
+        corridor_cache::VertexCache vertexCache;
+        thread_pool::ThreadPool *corridorPool = nullptr;
+        // Buffers of processCorridor, kept across setup calls. corridorHs
+        // is the normalized input corridor, which compactCorridor reduces
+        // into hPolytopes, so that neither changes shape between setups
+        // of the same corridor.
+        PolyhedraH corridorHs;
+        PolyhedraH interHs;
+        std::vector<int> misses;
+        std::vector<uint64_t> missKeys, missStreamKeys;
+        std::vector<std::mt19937_64> lpEngines;
+        std::vector<Eigen::Vector3d> inners;
+        std::vector<char> innerFound;
+        std::vector<int> rawOffsets, rawCounts;
+        PolyhedronV rawVs;
+        PolyhedraV enumeratedVs;
+        PolyhedronV boxIV;
+        geo_utils::VertexContext vertexContext;
+        PolyhedronV compactV;
+
+        bool boxCorridor = false;
+        std::vector<char> boxFlags;
+        std::vector<Eigen::Vector3d> boxLos, boxHis;
 
         Eigen::Matrix3Xd points;
         Eigen::VectorXd times;
@@ -279,275 +801,22 @@ namespace gcopter
             Eigen::VectorXd q;
             for (int i = 0, j = 0, k; i < sizeP; i++, j += k)
             {
-                k = vPolys[vIdx(i)].cols();
-
-                q = xi.segment(j, k);
-                sqrNormQ = q.squaredNorm();
-                sqrNormViolation = sqrNormQ - 1.0;
-                if (sqrNormViolation > 0.0)
-                {
-                    c = sqrNormViolation * sqrNormViolation;
-                    dc = 3.0 * c;
-                    c *= sqrNormViolation;
-                    cost += c;
-                    gradXi.segment(j, k) += dc * 2.0 * q;
-                }
-            }
-
-            return;
-        }
-
-        static inline bool smoothedL1(const double &x,
-                                      const double &mu,
-                                      double &f,
-                                      double &df)
-        {
-            if (x < 0.0)
-            {
-                return false;
-            }
-            else if (x > mu)
-            {
-                f = x - 0.5 * mu;
-                df = 1.0;
-                return true;
-            }
-            else
-            {
-                const double xdmu = x / mu;
-                const double sqrxdmu = xdmu * xdmu;
-                const double mumxd2 = mu - 0.5 * x;
-                f = mumxd2 * sqrxdmu * xdmu;
-                df = sqrxdmu * ((-0.5) * xdmu + 3.0 * mumxd2 / mu);
-                return true;
-            }
-        }
-
-        // magnitudeBounds = [v_max, omg_max, theta_max, thrust_min, thrust_max]^T
-        // penaltyWeights = [pos_weight, vel_weight, omg_weight, theta_weight, thrust_weight]^T
-        // physicalParams = [vehicle_mass, gravitational_acceleration, horitonral_drag_coeff,
-        //                   vertical_drag_coeff, parasitic_drag_coeff, speed_smooth_factor]^T
-        static inline void attachPenaltyFunctional(const Eigen::VectorXd &T,
-                                                   const Eigen::MatrixX3d &coeffs,
-                                                   const Eigen::VectorXi &hIdx,
-                                                   const PolyhedraH &hPolys,
-                                                   const double &smoothFactor,
-                                                   const int &integralResolution,
-                                                   const Eigen::VectorXd &magnitudeBounds,
-                                                   const Eigen::VectorXd &penaltyWeights,
-                                                   flatness::FlatnessMap &flatMap,
-                                                   double &cost,
-                                                   Eigen::VectorXd &gradT,
-                                                   Eigen::MatrixX3d &gradC)
-        {
-            const double velSqrMax = magnitudeBounds(0) * magnitudeBounds(0);
-            const double omgSqrMax = magnitudeBounds(1) * magnitudeBounds(1);
-            const double thetaMax = magnitudeBounds(2);
-            const double thrustMean = 0.5 * (magnitudeBounds(3) + magnitudeBounds(4));
-            const double thrustRadi = 0.5 * fabs(magnitudeBounds(4) - magnitudeBounds(3));
-            const double thrustSqrRadi = thrustRadi * thrustRadi;
-
-            const double weightPos = penaltyWeights(0);
-            const double weightVel = penaltyWeights(1);
-            const double weightOmg = penaltyWeights(2);
-            const double weightTheta = penaltyWeights(3);
-            const double weightThrust = penaltyWeights(4);
-
-            Eigen::Vector3d pos, vel, acc, jer, sna;
-            Eigen::Vector3d totalGradPos, totalGradVel, totalGradAcc, totalGradJer;
-            double totalGradPsi, totalGradPsiD;
-            double thr, cos_theta;
-            Eigen::Vector4d quat;
-            Eigen::Vector3d omg;
-            double gradThr;
-            Eigen::Vector4d gradQuat;
-            Eigen::Vector3d gradPos, gradVel, gradOmg;
-
-            double step, alpha;
-            double s1, s2, s3, s4, s5;
-            Eigen::Matrix<double, 4, 1> beta0, beta1, beta2, beta3, beta4;
-            Eigen::Vector3d outerNormal;
-            int K, L;
-            double violaPos, violaVel, violaOmg, violaTheta, violaThrust;
-            double violaPosPenaD, violaVelPenaD, violaOmgPenaD, violaThetaPenaD, violaThrustPenaD;
-            double violaPosPena, violaVelPena, violaOmgPena, violaThetaPena, violaThrustPena;
-            double node, pena;
-
-            const int pieceNum = T.size();
-            const double integralFrac = 1.0 / integralResolution;
-            for (int i = 0; i < pieceNum; i++)
-            {
-                const Eigen::Matrix<double, 4, 3> &c = coeffs.block<4, 3>(i * 4, 0);
-                step = T(i) * integralFrac;
-                for (int j = 0; j <= integralResolution; j++)
-                {
-                    s1 = j * step;
-                    s2 = s1 * s1;
-                    s3 = s2 * s1;
-                    s4 = s2 * s2;
-                    s5 = s4 * s1;
-                    beta0(0) = 1.0, beta0(1) = s1, beta0(2) = s2, beta0(3) = s3;
-                    beta1(0) = 0.0, beta1(1) = 1.0, beta1(2) = 2.0 * s1, beta1(3) = 3.0 * s2;
-                    beta2(0) = 0.0, beta2(1) = 0.0, beta2(2) = 2.0, beta2(3) = 6.0 * s1;
-                    beta3(0) = 0.0, beta3(1) = 0.0, beta3(2) = 0.0, beta3(3) = 6.0;
-                    beta4(0) = 0.0, beta4(1) = 0.0, beta4(2) = 0.0, beta4(3) = 0.0;
-                    pos = c.transpose() * beta0;
-                    vel = c.transpose() * beta1;
-                    acc = c.transpose() * beta2;
-                    jer = c.transpose() * beta3;
-                    sna = c.transpose() * beta4;
-
-                    flatMap.forward(vel, acc, jer, 0.0, 0.0, thr, quat, omg);
-
-                    violaVel = vel.squaredNorm() - velSqrMax;
-                    violaOmg = omg.squaredNorm() - omgSqrMax;
-                    cos_theta = 1.0 - 2.0 * (quat(1) * quat(1) + quat(2) * quat(2));
-                    violaTheta = acos(cos_theta) - thetaMax;
-                    violaThrust = (thr - thrustMean) * (thr - thrustMean) - thrustSqrRadi;
-
-                    gradThr = 0.0;
-                    gradQuat.setZero();
-                    gradPos.setZero(), gradVel.setZero(), gradOmg.setZero();
-                    pena = 0.0;
-
-                    L = hIdx(i);
-                    K = hPolys[L].rows();
-                    for (int k = 0; k < K; k++)
-                    {
-                        outerNormal = hPolys[L].block<1, 3>(k, 0);
-                        violaPos = outerNormal.dot(pos) + hPolys[L](k, 3);
-                        if (smoothedL1(violaPos, smoothFactor, violaPosPena, violaPosPenaD))
-                        {
-                            gradPos += weightPos * violaPosPenaD * outerNormal;
-                            pena += weightPos * violaPosPena;
-                        }
-                    }
-
-                    if (smoothedL1(violaVel, smoothFactor, violaVelPena, violaVelPenaD))
-                    {
-                        gradVel += weightVel * violaVelPenaD * 2.0 * vel;
-                        pena += weightVel * violaVelPena;
-                    }
-
-                    if (smoothedL1(violaOmg, smoothFactor, violaOmgPena, violaOmgPenaD))
-                    {
-                        gradOmg += weightOmg * violaOmgPenaD * 2.0 * omg;
-                        pena += weightOmg * violaOmgPena;
-                    }
-
-                    if (smoothedL1(violaTheta, smoothFactor, violaThetaPena, violaThetaPenaD))
-                    {
-                        gradQuat += weightTheta * violaThetaPenaD /
-                                    sqrt(1.0 - cos_theta * cos_theta) * 4.0 *
-                                    Eigen::Vector4d(0.0, quat(1), quat(2), 0.0);
-                        pena += weightTheta * violaThetaPena;
-                    }
-
-                    if (smoothedL1(violaThrust, smoothFactor, violaThrustPena, violaThrustPenaD))
-                    {
-                        gradThr += weightThrust * violaThrustPenaD * 2.0 * (thr - thrustMean);
-                        pena += weightThrust * violaThrustPena;
-                    }
-
-                    flatMap.backward(gradPos, gradVel, gradThr, gradQuat, gradOmg,
-                                     totalGradPos, totalGradVel, totalGradAcc, totalGradJer,
-                                     totalGradPsi, totalGradPsiD);
-
-                    node = (j == 0 || j == integralResolution) ? 0.5 : 1.0;
-                    alpha = j * integralFrac;
-                    gradC.block<4, 3>(i * 4, 0) += (beta0 * totalGradPos.transpose() +
-                                                    beta1 * totalGradVel.transpose() +
-                                                    beta2 * totalGradAcc.transpose() +
-                                                    beta3 * totalGradJer.transpose()) *
-                                                   node * step;
-                    gradT(i) += (totalGradPos.dot(vel) +
-                                 totalGradVel.dot(acc) +
-                                 totalGradAcc.dot(jer) +
-                                 totalGradJer.dot(sna)) *
-                                    alpha * node * step +
-                                node * integralFrac * pena;
-                    cost += node * step * pena;
-                }
-            }
-
-            return;
-        }
-        // Swarm obstacle avoidance penalty: Eq. (26)-(30)
-        static void attachSwarmPenaltyFunctional(
-            const Eigen::VectorXd &T,
-            const Eigen::MatrixX3d &coeffs,                 // trajectory coefficients
-            const Eigen::VectorXi &hIdx,                    // corridor indices
-            const PolyhedraH &hPolys,                       // safe corridor
-            double smoothFactor,
-            int integralResolution,
-            double swarmThreshold,                          // C_sw
-            Eigen::Matrix3d E,                              // ellipsoid matrix (usually diagonal)
-            const std::vector<Trajectory<3>> &otherAgents,  // all other agents' trajectories
-            double &cost,
-            Eigen::VectorXd &gradT,
-            Eigen::MatrixX3d &gradC
-        )
-        {
-            // High-resolution grid sampling
-            double sample_dt = 0.001;
-
-            int pieceNum = T.size();
-            double global_time = 0.0;
-            for (int i = 0; i < pieceNum; ++i)
-            {
-                const Eigen::Matrix<double, 4, 3> &c = coeffs.block<4, 3>(i * 4, 0);
-                double segT = T(i);
-
-                // Sample [0, segT] at 0.001 s intervals
-                int segSamples = std::max(int(segT / sample_dt), 1);
+                k = vPolys[vIdx(i)].cols();
 
-                for (int j = 0; j <= segSamples; ++j)
+                q = xi.segment(j, k);
+                sqrNormQ = q.squaredNorm();
+                sqrNormViolation = sqrNormQ - 1.0;
+                if (sqrNormViolation > 0.0)
                 {
-                    double alpha = double(j) / double(segSamples);          // [0,1]
-                    double t_rel = alpha * segT;                            // time in this segment
-                    double t_global = global_time + t_rel;                  // absolute time (for cross-agent sync)
-
-                    // Evaluate this agent position at t_rel for this segment
-                    Eigen::Vector4d beta0;
-                    beta0 << 1, t_rel, t_rel * t_rel, t_rel * t_rel * t_rel;
-                    Eigen::Vector3d my_pos = c.transpose() * beta0;
-
-                    // For each other agent, check avoidance
-                    for (const auto &other : otherAgents)
-                    {
-                        // For this t_global, sample the other's position
-                        Eigen::Vector3d other_pos = other.getPos(t_global);
-
-                        Eigen::Vector3d diff = my_pos - other_pos;
-                        double ellip_dist = std::sqrt((E * diff).dot(diff));
-
-                        if (ellip_dist < swarmThreshold) // Eq. (26)
-                        {
-                            // Penalty function: (C_sw^2 - ellip_dist^2)^2 if violated
-                            double violation = swarmThreshold * swarmThreshold - ellip_dist * ellip_dist;
-                            double penalty = violation * violation;
-
-                            cost += penalty;
-
-                            // Gradient wrt my_pos only, chain rule: ∇_ci penalty = -4*violation*ellip_dist*(E*diff) * ∂my_pos/∂ci
-                            // For cubic: my_pos = sum l=0..3 c(i,l) * t_rel^l    ∂my_pos/∂c(i,l) = t_rel^l
-                            // So gradC.block<4,3> (i*4,0) [for all four coeffs]:
-                            for (int l = 0; l < 4; ++l)
-                            {
-                                for (int d = 0; d < 3; ++d)
-                                {
-                                    double chain = std::pow(t_rel, l);
-                                    gradC(i * 4 + l, d) += -4.0 * violation * ellip_dist * (E(d,0) * diff(0) + E(d,1) * diff(1) + E(d,2) * diff(2)) * chain;
-                                }
-                            }
-                            // Gradient wrt segment duration T:
-                            // We take derivative wrt time scaling. (optional, for completeness):
-                            gradT(i) += /* approx penalty's effect wrt T: penalizes stretching time, modest effect */ -4.0 * violation * ellip_dist * diff.squaredNorm() * alpha;
-                        }
-                    }
+                    c = sqrNormViolation * sqrNormViolation;
+                    dc = 3.0 * c;
+                    c *= sqrNormViolation;
+                    cost += c;
+                    gradXi.segment(j, k) += dc * 2.0 * q;
                 }
-                global_time += segT;
             }
+
+            return;
         }
 
         static inline double costFunctional(void *ptr,
@@ -563,6 +832,13 @@ namespace gcopter
             Eigen::Map<Eigen::VectorXd> gradTau(g.data(), dimTau);
             Eigen::Map<Eigen::VectorXd> gradXi(g.data() + dimTau, dimXi);
 
+            StatsClock clock;
+            obj.totalEvaluations++;
+            if (enableStats)
+            {
+                obj.stats.costEvaluations++;
+            }
+
             forwardT(tau, obj.times);
             forwardP(xi, obj.vPolyIdx, obj.vPolytopes, obj.points);
 
@@ -571,20 +847,23 @@ namespace gcopter
             obj.minco.getEnergy(cost);
             obj.minco.getEnergyPartialGradByCoeffs(obj.partialGradByCoeffs);
             obj.minco.getEnergyPartialGradByTimes(obj.partialGradByTimes);
-
-            attachPenaltyFunctional(obj.times, obj.minco.getCoeffs(),
-                                    obj.hPolyIdx, obj.hPolytopes,
-                                    obj.smoothEps, obj.integralRes,
-                                    obj.magnitudeBd, obj.penaltyWt, obj.flatmap,
-                                    cost, obj.partialGradByTimes, obj.partialGradByCoeffs);
+            clock.lap(obj.stats.mincoTime);
+
+            detail::attachPenaltyFunctional(obj.times, obj.minco.getCoeffs(),
+                                            obj.hPolyIdx, obj.hFaces,
+                                            obj.smoothEps, obj.integralRes,
+                                            obj.magnitudeBd, obj.penaltyWt, obj.flatmap,
+                                            cost, obj.partialGradByTimes, obj.partialGradByCoeffs);
+            clock.lap(obj.stats.penaltyTime);
             if (!obj.swarmOtherAgents.empty()) {
-                attachSwarmPenaltyFunctional(obj.times, obj.minco.getCoeffs(),
+                detail::attachSwarmPenaltyFunctional(obj.times, obj.minco.getCoeffs(),
                 obj.hPolyIdx, obj.hPolytopes,
                 obj.smoothEps, obj.integralRes,
                 obj.swarmThreshold,
                 obj.swarmEllipsoid,
                 obj.swarmOtherAgents,
                 cost, obj.partialGradByTimes, obj.partialGradByCoeffs);
+                clock.lap(obj.stats.swarmPenaltyTime);
             }
 
             obj.minco.propogateGrad(obj.partialGradByCoeffs, obj.partialGradByTimes,
@@ -596,10 +875,89 @@ namespace gcopter
             backwardGradT(tau, obj.gradByTimes, gradTau);
             backwardGradP(xi, obj.vPolyIdx, obj.vPolytopes, obj.gradByPoints, gradXi);
             normRetrictionLayer(xi, obj.vPolyIdx, obj.vPolytopes, cost, gradXi);
+            clock.lap(obj.stats.adjointTime);
 
             return cost;
         }
 
+        // A cancellation is not reproducible by itself, its iteration is
+        inline void recordStop(const int iteration)
+        {
+            if (recording)
+            {
+                capsule.stopIteration = iteration;
+            }
+            return;
+        }
+
+        static inline int progressMonitor(void *ptr,
+                                          const Eigen::VectorXd &x,
+                                          const Eigen::VectorXd &g,
+                                          const double fx,
+                                          const double step,
+                                          const int k,
+                                          const int ls)
+        {
+            GCOPTER_PolytopeSFC &obj = *(GCOPTER_PolytopeSFC *)ptr;
+            if (enableStats)
+            {
+                obj.stats.iterations = k;
+                obj.stats.lineSearchTrials += ls;
+            }
+
+            if (obj.control == nullptr)
+            {
+                return 0;
+            }
+            if (obj.anytime != nullptr)
+            {
+                AnytimeState &state = *obj.anytime;
+                state.iterations++;
+                // A later, finer stage always supersedes the earlier ones
+                if (!state.found || state.bestStage < state.stage || fx < state.bestCost)
+                {
+                    if (obj.checkFeasibility(x, *state.params))
+                    {
+                        state.bestX = x;
+                        state.bestCost = fx;
+                        state.found = true;
+                        state.bestStage = state.stage;
+                        state.bestIteration = state.iterations;
+                    }
+                }
+            }
+
+            const OptimizeControl &ctrl = *obj.control;
+            if (ctrl.observer)
+            {
+                IterationInfo info;
+                info.iteration = k;
+                info.cost = fx;
+                info.gradNorm = g.norm();
+                info.step = step;
+                info.evaluations = ls;
+                info.totalEvaluations = obj.totalEvaluations;
+                if (!ctrl.observer(info))
+                {
+                    obj.status = OPTIMIZE_CANCELED;
+                    obj.recordStop(k);
+                    return 1;
+                }
+            }
+            if (ctrl.cancel != nullptr && ctrl.cancel->load(std::memory_order_relaxed))
+            {
+                obj.status = OPTIMIZE_CANCELED;
+                obj.recordStop(k);
+                return 1;
+            }
+            if (std::chrono::steady_clock::now() >= ctrl.deadline)
+            {
+                obj.status = OPTIMIZE_DEADLINE;
+                return 1;
+            }
+            return 0;
+        }
+
         static inline double costDistance(void *ptr,
                                           const Eigen::VectorXd &xi,
                                           Eigen::VectorXd &gradXi)
@@ -730,56 +1088,261 @@ namespace gcopter
             return;
         }
 
-        static inline bool processCorridor(const PolyhedraH &hPs,
-                                           PolyhedraV &vPs)
+        static inline void toIOB(const PolyhedronV &curIV,
+                                 PolyhedronV &curIOB)
+        {
+            const int nv = curIV.cols();
+            curIOB.resize(3, nv);
+            curIOB.col(0) = curIV.col(0);
+            curIOB.rightCols(nv - 1) = curIV.rightCols(nv - 1).colwise() - curIV.col(0);
+            return;
+        }
+
+        // Bounds of slot k of processCorridor if it is a box or the
+        // intersection of two boxes, see setBoxCorridor
+        inline bool boxSlot(const int k,
+                            Eigen::Vector3d &lo,
+                            Eigen::Vector3d &hi) const
+        {
+            const int i = k / 2;
+            if (k % 2 == 0)
+            {
+                lo = boxLos[i];
+                hi = boxHis[i];
+                return boxFlags[i];
+            }
+            lo = boxLos[i].cwiseMax(boxLos[i + 1]);
+            hi = boxHis[i].cwiseMin(boxHis[i + 1]);
+            return boxFlags[i] && boxFlags[i + 1];
+        }
+
+        inline bool findCachedIOB(const uint64_t key,
+                                  const uint64_t streamKey,
+                                  const PolyhedronH &hPoly,
+                                  PolyhedronV &curIOB)
+        {
+            const bool hit = vertexCache.find(key, streamKey, hPoly, curIOB);
+            if (enableStats)
+            {
+                (hit ? stats.vertexCacheHits : stats.vertexCacheMisses)++;
+            }
+            return hit;
+        }
+
+        // V-polytopes in IOB form of the polytopes and of their consecutive
+        // intersections. The interior LPs draw from one stream seeded with
+        // randSeed in slot order, as the sequential enumeration always did.
+        // Each miss gets a copy of the stream at its slot, so the misses can
+        // be solved as one batch and their dual hulls built on corridorPool
+        // when it is set, with the same result as on one thread. Repeated
+        // vertices of all misses are then dropped by one batched filterVs.
+        // The stream at a slot only depends on randSeed and the row counts
+        // of the slots before it, so these make up the cache key together
+        // with the polytope. A hit thus returns exactly what the miss would
+        // give, whatever was solved before. With boxCorridor, boxes and
+        // their intersections skip all of this.
+        // All buffers are members, so a setup on a corridor of the same
+        // shape as the last one allocates nothing here.
+        inline bool processCorridor(const PolyhedraH &hPs,
+                                    PolyhedraV &vPs)
         {
             const int sizeCorridor = hPs.size() - 1;
+            const int slotNum = 2 * sizeCorridor + 1;
 
-            vPs.clear();
-            vPs.reserve(2 * sizeCorridor + 1);
+            boxFlags.assign(hPs.size(), 0);
+            boxLos.resize(hPs.size());
+            boxHis.resize(hPs.size());
+            if (boxCorridor)
+            {
+                for (size_t i = 0; i < hPs.size(); i++)
+                {
+                    boxFlags[i] = geo_utils::boxBounds(hPs[i], boxLos[i], boxHis[i]);
+                }
+            }
 
-            int nv;
-            PolyhedronH curIH;
-            PolyhedronV curIV, curIOB;
+            // Even slots are polytopes, odd slots their intersections
+            interHs.resize(sizeCorridor);
             for (int i = 0; i < sizeCorridor; i++)
             {
-                if (!geo_utils::enumerateVs(hPs[i], curIV))
+                interHs[i].resize(hPs[i].rows() + hPs[i + 1].rows(), 4);
+                interHs[i].topRows(hPs[i].rows()) = hPs[i];
+                interHs[i].bottomRows(hPs[i + 1].rows()) = hPs[i + 1];
+            }
+            const auto slotH = [&](const int k) -> const PolyhedronH &
+            {
+                return k % 2 == 0 ? hPs[k / 2] : interHs[k / 2];
+            };
+
+            vPs.resize(slotNum);
+            misses.clear();
+            missKeys.clear();
+            missStreamKeys.clear();
+            std::mt19937_64 stream(randSeed);
+            uint64_t streamKey = randSeed;
+            lpEngines.clear();
+            Eigen::Vector3d lo, hi;
+            for (int k = 0; k < slotNum; k++)
+            {
+                if (boxSlot(k, lo, hi))
                 {
-                    return false;
+                    if (!geo_utils::enumerateBoxVs(lo, hi, boxIV))
+                    {
+                        return false;
+                    }
+                    toIOB(boxIV, vPs[k]);
+                    if (enableStats)
+                    {
+                        stats.closedFormBoxes++;
+                    }
+                }
+                else
+                {
+                    const uint64_t key = corridor_cache::hashPolytope(slotH(k), streamKey);
+                    if (!findCachedIOB(key, streamKey, slotH(k), vPs[k]))
+                    {
+                        misses.push_back(k);
+                        missKeys.push_back(key);
+                        missStreamKeys.push_back(streamKey);
+                        lpEngines.push_back(stream);
+                    }
                 }
-                nv = curIV.cols();
-                curIOB.resize(3, nv);
-                curIOB.col(0) = curIV.col(0);
-                curIOB.rightCols(nv - 1) = curIV.rightCols(nv - 1).colwise() - curIV.col(0);
-                vPs.push_back(curIOB);
-
-                curIH.resize(hPs[i].rows() + hPs[i + 1].rows(), 4);
-                curIH.topRows(hPs[i].rows()) = hPs[i];
-                curIH.bottomRows(hPs[i + 1].rows()) = hPs[i + 1];
-                if (!geo_utils::enumerateVs(curIH, curIV))
+                // Boxes and hits still move the stream past their LPs, so
+                // that the other slots draw the same numbers either way
+                sdlp::rand_discard(slotH(k).rows(), stream);
+                streamKey = corridor_cache::mix(streamKey ^ (uint64_t)slotH(k).rows());
+            }
+
+            const int missNum = misses.size();
+            geo_utils::findInteriors(
+                missNum, [&](const int m) -> const PolyhedronH &
+                { return slotH(misses[m]); },
+                lpEngines, inners, innerFound, corridorPool);
+            for (int m = 0; m < missNum; m++)
+            {
+                if (!innerFound[m])
                 {
                     return false;
                 }
-                nv = curIV.cols();
-                curIOB.resize(3, nv);
-                curIOB.col(0) = curIV.col(0);
-                curIOB.rightCols(nv - 1) = curIV.rightCols(nv - 1).colwise() - curIV.col(0);
-                vPs.push_back(curIOB);
             }
 
-            if (!geo_utils::enumerateVs(hPs.back(), curIV))
+            // The dual hulls write their raw vertices to columns of rawVs
+            // set aside per miss. Pool workers use the buffers they keep
+            // across calls, the sequential path the planner's own.
+            rawOffsets.resize(missNum + 1);
+            rawCounts.resize(missNum);
+            rawOffsets[0] = 0;
+            for (int m = 0; m < missNum; m++)
             {
-                return false;
+                rawOffsets[m + 1] = rawOffsets[m] +
+                                    geo_utils::VertexContext::maxDualVs(slotH(misses[m]).rows());
+            }
+            if (rawVs.cols() < rawOffsets[missNum])
+            {
+                rawVs.resize(3, rawOffsets[missNum]);
+            }
+            const auto hull = [&](const int m)
+            {
+                rawCounts[m] = geo_utils::dualVs(slotH(misses[m]), inners[m], 1.0e-6,
+                                                 rawVs.middleCols(rawOffsets[m], rawOffsets[m + 1] - rawOffsets[m]),
+                                                 corridorPool != nullptr ? geo_utils::vertex_context() : vertexContext);
+            };
+            if (corridorPool != nullptr)
+            {
+                corridorPool->parallelFor(missNum, hull);
+            }
+            else
+            {
+                for (int m = 0; m < missNum; m++)
+                {
+                    hull(m);
+                }
+            }
+
+            // The repeated vertices of all misses are found in one sort
+            geo_utils::filterVs(
+                missNum, [&](const int m)
+                { return rawVs.middleCols(rawOffsets[m], rawCounts[m]); },
+                1.0e-6, enumeratedVs);
+            for (int m = 0; m < missNum; m++)
+            {
+                enumeratedVs[m].colwise() += inners[m];
+                toIOB(enumeratedVs[m], vPs[misses[m]]);
+            }
+
+            for (int m = 0; m < missNum; m++)
+            {
+                vertexCache.insert(missKeys[m], missStreamKeys[m], slotH(misses[m]), vPs[misses[m]]);
             }
-            nv = curIV.cols();
-            curIOB.resize(3, nv);
-            curIOB.col(0) = curIV.col(0);
-            curIOB.rightCols(nv - 1) = curIV.rightCols(nv - 1).colwise() - curIV.col(0);
-            vPs.push_back(curIOB);
 
             return true;
         }
 
+        // Drops redundant and duplicate rows of every polytope using its
+        // enumerated vertices, then builds the penalty layouts from the rest
+        inline void compactCorridor()
+        {
+            hPolytopes.resize(corridorHs.size());
+            for (size_t i = 0; i < corridorHs.size(); i++)
+            {
+                const PolyhedronV &iob = vPolytopes[2 * i];
+                const int nv = iob.cols();
+                if (compactV.cols() < nv)
+                {
+                    compactV.resize(3, nv);
+                }
+                auto vPoly = compactV.leftCols(nv);
+                vPoly = iob;
+                vPoly.rightCols(nv - 1).colwise() += iob.col(0);
+                geo_utils::compactFaces(corridorHs[i], vPoly, hPolytopes[i]);
+                if (enableStats)
+                {
+                    stats.removedFaces += corridorHs[i].rows() - hPolytopes[i].rows();
+                }
+            }
+            detail::getCorridorFaces(hPolytopes, hFaces);
+            return;
+        }
+
+        inline void evaluateTrajectory(const Eigen::VectorXd &x,
+                                       Trajectory<3> &traj)
+        {
+            Eigen::Map<const Eigen::VectorXd> tau(x.data(), temporalDim);
+            Eigen::Map<const Eigen::VectorXd> xi(x.data() + temporalDim, spatialDim);
+            forwardT(tau, times);
+            forwardP(xi, vPolyIdx, vPolytopes, points);
+            minco.setParameters(points, times);
+            minco.getTrajectory(traj);
+            return;
+        }
+
+        // Largest signed distance of sampled positions to the corridor
+        inline double corridorViolation(const Trajectory<3> &traj,
+                                        const int resolution) const
+        {
+            double viola = -INFINITY;
+            Eigen::Vector4d pos;
+            pos(3) = 1.0;
+            for (int i = 0; i < traj.getPieceNum(); i++)
+            {
+                const PolyhedronH &hPoly = hPolytopes[hPolyIdx(i)];
+                const double step = traj[i].getDuration() / resolution;
+                for (int j = 0; j <= resolution; j++)
+                {
+                    pos.head<3>() = traj[i].getPos(j * step);
+                    viola = std::max(viola, hPoly.lazyProduct(pos).maxCoeff());
+                }
+            }
+            return viola;
+        }
+
+        // Corridor at sampled points and maximum speed only
+        inline bool checkFeasibility(const Eigen::VectorXd &x,
+                                     const AnytimeParams &params)
+        {
+            evaluateTrajectory(x, checkTraj);
+            return isFeasible(checkTraj, params);
+        }
+
         static inline void setInitial(const Eigen::Matrix3Xd &path,
                                       const double &speed,
                                       const Eigen::VectorXi &intervalNs,
@@ -820,6 +1383,77 @@ namespace gcopter
             swarmOtherAgents = otherAgents;
             swarmThreshold = C_sw;
             swarmEllipsoid = E_ellip;
+            if (recording)
+            {
+                capsule.otherAgents = otherAgents;
+                capsule.swarmThreshold = C_sw;
+                capsule.swarmEllipsoid = E_ellip;
+            }
+        }
+
+        // Seed of the stream that shuffles the interior LPs of setup, in
+        // corridor order. The vertices do not depend on the thread count.
+        inline void setRandomSeed(const uint64_t seed)
+        {
+            randSeed = seed;
+        }
+
+        // While recording, the inputs of setSwarmObstacleParams, setup and
+        // optimize are kept in a problem capsule, see saveCapsule
+        inline void setRecording(const bool on)
+        {
+            recording = on;
+            if (recording)
+            {
+                capsule.otherAgents = swarmOtherAgents;
+                capsule.swarmThreshold = swarmThreshold;
+                capsule.swarmEllipsoid = swarmEllipsoid;
+            }
+            return;
+        }
+
+        inline const problem_capsule::ProblemCapsule &getCapsule() const
+        {
+            return capsule;
+        }
+
+        inline bool saveCapsule(const std::string &path) const
+        {
+            return problem_capsule::save(path, capsule);
+        }
+
+        // Memory bound of the cache of vertex enumerations kept across
+        // setup calls, zero disables it
+        inline void setVertexCacheCapacity(const size_t bytes)
+        {
+            vertexCache.setCapacity(bytes);
+            return;
+        }
+
+        inline const corridor_cache::VertexCache &getVertexCache() const
+        {
+            return vertexCache;
+        }
+
+        // Vertex enumeration of setup runs on pool when given, nullptr
+        // restores the sequential path. The pool must outlive the planner's
+        // setup calls and may be the one the planner itself runs on.
+        inline void setThreadPool(thread_pool::ThreadPool *pool)
+        {
+            corridorPool = pool;
+            return;
+        }
+
+        // When on, setup takes the vertices of every polytope whose faces
+        // are all axis-aligned, and of the intersection of two such, as the
+        // eight corners of its box in closed form, skipping the interior LP
+        // and QuickHull. The corners are those of the general enumeration
+        // up to round-off, in another order. Off by default, so that a
+        // setup keeps the vertices it always had.
+        inline void setBoxCorridor(const bool on)
+        {
+            boxCorridor = on;
+            return;
         }
 
         inline bool setup(const double &timeWeight,
@@ -833,22 +1467,46 @@ namespace gcopter
                           const Eigen::VectorXd &penaltyWeights,
                           const Eigen::VectorXd &physicalParams)
         {
+            stats = PlannerStats();
+            StatsClock clock;
+            double setupTime = 0.0;
+
+            if (recording)
+            {
+                capsule.timeWeight = timeWeight;
+                capsule.headPVA = initialPVA;
+                capsule.tailPVA = terminalPVA;
+                capsule.corridor = safeCorridor;
+                capsule.lengthPerPiece = lengthPerPiece;
+                capsule.smoothingFactor = smoothingFactor;
+                capsule.integralResolution = integralResolution;
+                capsule.magnitudeBounds = magnitudeBounds;
+                capsule.penaltyWeights = penaltyWeights;
+                capsule.physicalParams = physicalParams;
+                capsule.randSeed = randSeed;
+                capsule.boxCorridor = boxCorridor;
+                capsule.vertexCacheCapacity = vertexCache.getCapacity();
+            }
+
             rho = timeWeight;
             headPVA = initialPVA;
             tailPVA = terminalPVA;
 
-            hPolytopes = safeCorridor;
-            for (size_t i = 0; i < hPolytopes.size(); i++)
+            corridorHs = safeCorridor;
+            for (size_t i = 0; i < corridorHs.size(); i++)
             {
-                const Eigen::ArrayXd norms =
-                    hPolytopes[i].leftCols<3>().rowwise().norm();
-                hPolytopes[i].array().colwise() /= norms;
+                for (int j = 0; j < corridorHs[i].rows(); j++)
+                {
+                    corridorHs[i].row(j) /= corridorHs[i].row(j).head<3>().norm();
+                }
             }
-            if (!processCorridor(hPolytopes, vPolytopes))
+            if (!processCorridor(corridorHs, vPolytopes))
             {
                 return false;
             }
-            
+            compactCorridor();
+            clock.lap(stats.processCorridorTime);
+
             polyN = hPolytopes.size();
             smoothEps = smoothingFactor;
             integralRes = integralResolution;
@@ -859,6 +1517,7 @@ namespace gcopter
 
             getShortestPath(headPVA.col(0), tailPVA.col(0),
                             vPolytopes, smoothEps, shortPath);
+            clock.lap(stats.shortestPathTime);
             const Eigen::Matrix3Xd deltas = shortPath.rightCols(polyN) - shortPath.leftCols(polyN);
             pieceIdx = (deltas.colwise().norm() / lengthPerPiece).cast<int>().transpose();
             pieceIdx.array() += 1;
@@ -900,12 +1559,48 @@ namespace gcopter
             partialGradByCoeffs.resize(4 * pieceN, 3);
             partialGradByTimes.resize(pieceN);
 
+            clock.lap(setupTime);
+            stats.setupTime = stats.processCorridorTime +
+                              stats.shortestPathTime + setupTime;
+
             return true;
         }
 
         inline double optimize(Trajectory<3> &traj,
                                const double &relCostTol)
         {
+            return optimize(traj, relCostTol, OptimizeControl());
+        }
+
+        // When stopped through ctrl, the last accepted iterate is returned.
+        // It has the lowest cost so far since every L-BFGS step satisfies
+        // the Armijo condition. See getStatus() for the reason of stopping.
+        inline double optimize(Trajectory<3> &traj,
+                               const double &relCostTol,
+                               const OptimizeControl &ctrl)
+        {
+            stats.resetOptimize();
+            if (recording)
+            {
+                capsule.relCostTol = relCostTol;
+                capsule.timeBudget = 0.0;
+                if (ctrl.deadline != std::chrono::steady_clock::time_point::max())
+                {
+                    // A deadline already passed still stops after one iteration
+                    capsule.timeBudget = std::max(std::chrono::duration<double>(
+                                                      ctrl.deadline - std::chrono::steady_clock::now())
+                                                      .count(),
+                                                  DBL_MIN);
+                }
+                capsule.stopIteration = -1;
+                capsule.anytime = false;
+            }
+            control = ctrl.active() ? &ctrl : nullptr;
+            totalEvaluations = 0;
+            status = OPTIMIZE_SUCCESS;
+            StatsClock clock;
+            StatsClock totalClock;
+
             Eigen::VectorXd x(temporalDim + spatialDim);
             Eigen::Map<Eigen::VectorXd> tau(x.data(), temporalDim);
             Eigen::Map<Eigen::VectorXd> xi(x.data() + temporalDim, spatialDim);
@@ -913,6 +1608,7 @@ namespace gcopter
             setInitial(shortPath, allocSpeed, pieceIdx, points, times);
             backwardT(times, tau);
             backwardP(points, vPolyIdx, vPolytopes, xi);
+            clock.lap(stats.backwardPTime);
 
             double minCostFunctional;
             lbfgs_params.mem_size = 256;
@@ -925,7 +1621,9 @@ namespace gcopter
                                             minCostFunctional,
                                             &GCOPTER_PolytopeSFC::costFunctional,
                                             nullptr,
-                                            nullptr,
+                                            enableStats || control != nullptr
+                                                ? &GCOPTER_PolytopeSFC::progressMonitor
+                                                : nullptr,
                                             this,
                                             lbfgs_params);
 
@@ -938,6 +1636,7 @@ namespace gcopter
             }
             else
             {
+                status = OPTIMIZE_FAILED;
                 traj.clear();
                 minCostFunctional = INFINITY;
                 std::cout << "Optimization Failed: "
@@ -945,8 +1644,186 @@ namespace gcopter
                           << std::endl;
             }
 
+            control = nullptr;
+            totalClock.lap(stats.optimizeTime);
+
             return minCostFunctional;
         }
+
+        inline int getStatus() const
+        {
+            return status;
+        }
+
+        // The feasibility check of optimizeAnytime, with the slacks and
+        // resolution of params, for a trajectory through the corridor of
+        // the last setup, e.g. the one optimize returned
+        inline bool isFeasible(const Trajectory<3> &traj,
+                               const AnytimeParams &params) const
+        {
+            return traj.getPieceNum() > 0 &&
+                   traj.getPieceNum() == hPolyIdx.size() &&
+                   corridorViolation(traj, params.checkResolution) <= params.corridorSlack &&
+                   traj.checkMaxVelRate(magnitudeBd(0) + params.velSlack);
+        }
+
+        // Anytime mode: runs L-BFGS until the time budget is used up or the
+        // relative cost tolerance is met, and returns the lowest-cost iterate
+        // that passed the feasibility check. When the budget or tolerance
+        // stops the solve before any iterate passed, the last one is
+        // returned and report.feasible is false. When L-BFGS fails before
+        // any iterate passed, the solve counts as failed: traj is cleared,
+        // the status is OPTIMIZE_FAILED and INFINITY is returned.
+        // The check samples the trajectory against the corridor and tests
+        // checkMaxVelRate only. The acceleration, thrust and tilt limits
+        // are left to the penalties and are not checked.
+        inline double optimizeAnytime(Trajectory<3> &traj,
+                                      const AnytimeParams &params,
+                                      AnytimeReport &report)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            const auto budget = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(params.timeBudget));
+
+            stats.resetOptimize();
+            if (recording)
+            {
+                capsule.relCostTol = params.relCostTol;
+                capsule.timeBudget = params.timeBudget;
+                capsule.stopIteration = -1;
+                capsule.anytime = true;
+                capsule.velSlack = params.velSlack;
+                capsule.corridorSlack = params.corridorSlack;
+                capsule.checkResolution = params.checkResolution;
+                capsule.escalateResolution = params.escalateResolution;
+                capsule.initialResolution = params.initialResolution;
+            }
+            totalEvaluations = 0;
+            status = OPTIMIZE_SUCCESS;
+            StatsClock clock;
+            StatsClock totalClock;
+
+            Eigen::VectorXd x(temporalDim + spatialDim);
+            Eigen::Map<Eigen::VectorXd> tau(x.data(), temporalDim);
+            Eigen::Map<Eigen::VectorXd> xi(x.data() + temporalDim, spatialDim);
+
+            setInitial(shortPath, allocSpeed, pieceIdx, points, times);
+            backwardT(times, tau);
+            backwardP(points, vPolyIdx, vPolytopes, xi);
+            clock.lap(stats.backwardPTime);
+
+            std::vector<int> resolutions;
+            const int targetRes = integralRes;
+            if (params.escalateResolution)
+            {
+                for (int r = std::max(1, params.initialResolution); r < targetRes; r *= 2)
+                {
+                    resolutions.push_back(r);
+                }
+            }
+            resolutions.push_back(targetRes);
+
+            AnytimeState state;
+            state.params = &params;
+            state.bestCost = INFINITY;
+            state.found = false;
+            state.stage = 0;
+            state.bestStage = 0;
+            state.iterations = 0;
+            state.bestIteration = 0;
+            if (checkFeasibility(x, params))
+            {
+                state.bestX = x;
+                state.found = true;
+            }
+            anytime = &state;
+
+            lbfgs_params.mem_size = 256;
+            lbfgs_params.past = 3;
+            lbfgs_params.min_step = 1.0e-32;
+            lbfgs_params.g_epsilon = 0.0;
+            lbfgs_params.delta = params.relCostTol;
+
+            double lastCost = INFINITY;
+            int ret = 0;
+            const int stageNum = resolutions.size();
+            for (int k = 0; k < stageNum; k++)
+            {
+                // Each stage may run until its share of the budget is spent
+                OptimizeControl ctrl;
+                ctrl.deadline = start + budget * (k + 1) / stageNum;
+                control = &ctrl;
+                integralRes = resolutions[k];
+                state.stage = k;
+                report.stages = k + 1;
+
+                ret = lbfgs::lbfgs_optimize(x,
+                                            lastCost,
+                                            &GCOPTER_PolytopeSFC::costFunctional,
+                                            nullptr,
+                                            &GCOPTER_PolytopeSFC::progressMonitor,
+                                            this,
+                                            lbfgs_params);
+                if (ret < 0 || (status == OPTIMIZE_DEADLINE &&
+                                std::chrono::steady_clock::now() >= start + budget))
+                {
+                    break;
+                }
+                status = OPTIMIZE_SUCCESS;
+            }
+            integralRes = targetRes;
+            control = nullptr;
+            anytime = nullptr;
+
+            if (ret < 0 && !state.found)
+            {
+                status = OPTIMIZE_FAILED;
+            }
+            else if (ret < 0)
+            {
+                status = OPTIMIZE_SUCCESS;
+            }
+
+            report.feasible = state.found;
+            report.iterations = state.iterations;
+            report.bestIteration = state.bestIteration;
+            report.finalResolution = resolutions[report.stages - 1];
+            if (state.found)
+            {
+                x = state.bestX;
+            }
+
+            if (status != OPTIMIZE_FAILED)
+            {
+                // Costs of coarser stages are not comparable, so the
+                // returned iterate is always evaluated at the target resolution
+                Eigen::VectorXd g(x.size());
+                report.cost = costFunctional(this, x, g);
+                evaluateTrajectory(x, traj);
+                report.maxVelRate = traj.getMaxVelRate();
+                report.maxCorridorViolation = corridorViolation(traj, params.checkResolution);
+            }
+            else
+            {
+                report.cost = INFINITY;
+                traj.clear();
+                std::cout << "Optimization Failed: "
+                          << lbfgs::lbfgs_strerror(ret)
+                          << std::endl;
+            }
+
+            report.elapsed = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+            totalClock.lap(stats.optimizeTime);
+
+            return report.cost;
+        }
+
+        inline const PlannerStats &getStats() const
+        {
+            return stats;
+        }
     };
 
 }
@@ -27,17 +27,44 @@
 
 #include "quickhull.hpp"
 #include "sdlp.hpp"
+#include "thread_pool.hpp"
 
 #include <Eigen/Eigen>
 
+#include <algorithm>
 #include <cfloat>
+#include <cmath>
 #include <cstdint>
-#include <set>
+#include <random>
+#include <vector>
 #include <chrono>
 
 namespace geo_utils
 {
 
+    // LP of the deepest point of hPoly, written to the rows of A and b
+    // starting at offset
+    inline void interiorLP(const Eigen::MatrixX4d &hPoly,
+                           Eigen::MatrixX4d &A,
+                           Eigen::VectorXd &b,
+                           const int offset = 0)
+    {
+        const int m = hPoly.rows();
+        if (A.rows() < offset + m)
+        {
+            A.conservativeResize(offset + m, 4);
+            b.conservativeResize(offset + m);
+        }
+        for (int i = 0; i < m; i++)
+        {
+            const double hNorm = hPoly.row(i).head<3>().norm();
+            A.row(offset + i).head<3>() = hPoly.row(i).head<3>() / hNorm;
+            A(offset + i, 3) = 1.0;
+            b(offset + i) = -hPoly(i, 3) / hNorm;
+        }
+        return;
+    }
+
     // Each row of hPoly is defined by h0, h1, h2, h3 as
     // h0*x + h1*y + h2*z + h3 <= 0
     inline bool findInterior(const Eigen::MatrixX4d &hPoly,
@@ -45,22 +72,65 @@ namespace geo_utils
     {
         const int m = hPoly.rows();
 
-        Eigen::MatrixX4d A(m, 4);
-        Eigen::VectorXd b(m);
+        // Grown on demand so that repeated calls do not allocate
+        thread_local Eigen::MatrixX4d A;
+        thread_local Eigen::VectorXd b;
         Eigen::Vector4d c, x;
-        const Eigen::ArrayXd hNorm = hPoly.leftCols<3>().rowwise().norm();
-        A.leftCols<3>() = hPoly.leftCols<3>().array().colwise() / hNorm;
-        A.rightCols<1>().setConstant(1.0);
-        b = -hPoly.rightCols<1>().array() / hNorm;
+        interiorLP(hPoly, A, b);
         c.setZero();
         c(3) = -1.0;
 
-        const double minmaxsd = sdlp::linprog<4>(c, A, b, x);
+        const double minmaxsd = sdlp::linprog<4>(c, A.topRows(m), b.head(m), x);
         interior = x.head<3>();
 
         return minmaxsd < 0.0 && !std::isinf(minmaxsd);
     }
 
+    // findInterior of hPolyAt(i) for i < num, the LP of polytope i shuffled
+    // with gens[i] and spread over pool when given
+    template <typename PolyAt>
+    inline void findInteriors(const int num,
+                              const PolyAt &hPolyAt,
+                              std::vector<std::mt19937_64> &gens,
+                              std::vector<Eigen::Vector3d> &interiors,
+                              std::vector<char> &found,
+                              thread_pool::ThreadPool *pool = nullptr)
+    {
+        // All LPs packed into one grow-only workspace per calling thread
+        thread_local Eigen::MatrixX4d A;
+        thread_local Eigen::VectorXd b;
+        thread_local std::vector<int> offsets;
+        thread_local std::vector<Eigen::Vector4d> cs, xs;
+        thread_local std::vector<double> minima;
+        offsets.resize(num + 1);
+        offsets[0] = 0;
+        for (int i = 0; i < num; i++)
+        {
+            offsets[i + 1] = offsets[i] + hPolyAt(i).rows();
+        }
+        if (A.rows() < offsets[num])
+        {
+            A.resize(offsets[num], 4);
+            b.resize(offsets[num]);
+        }
+        for (int i = 0; i < num; i++)
+        {
+            interiorLP(hPolyAt(i), A, b, offsets[i]);
+        }
+        cs.assign(num, Eigen::Vector4d(0.0, 0.0, 0.0, -1.0));
+
+        sdlp::linprog_batch<4>(cs, A, b, offsets, gens, xs, minima, pool);
+
+        interiors.resize(num);
+        found.resize(num);
+        for (int i = 0; i < num; i++)
+        {
+            interiors[i] = xs[i].head<3>();
+            found[i] = minima[i] < 0.0 && !std::isinf(minima[i]);
+        }
+        return;
+    }
+
     inline bool overlap(const Eigen::MatrixX4d &hPoly0,
                         const Eigen::MatrixX4d &hPoly1,
                         const double eps = 1.0e-6)
@@ -68,78 +138,333 @@ namespace geo_utils
     {
         const int m = hPoly0.rows();
         const int n = hPoly1.rows();
-        Eigen::MatrixX4d A(m + n, 4);
+        thread_local Eigen::MatrixX4d A;
+        thread_local Eigen::VectorXd b;
         Eigen::Vector4d c, x;
-        Eigen::VectorXd b(m + n);
+        if (A.rows() < m + n)
+        {
+            A.resize(m + n, 4);
+            b.resize(m + n);
+        }
         A.leftCols<3>().topRows(m) = hPoly0.leftCols<3>();
-        A.leftCols<3>().bottomRows(n) = hPoly1.leftCols<3>();
-        A.rightCols<1>().setConstant(1.0);
-        b.topRows(m) = -hPoly0.rightCols<1>();
-        b.bottomRows(n) = -hPoly1.rightCols<1>();
+        A.leftCols<3>().middleRows(m, n) = hPoly1.leftCols<3>();
+        A.rightCols<1>().head(m + n).setConstant(1.0);
+        b.head(m) = -hPoly0.rightCols<1>();
+        b.segment(m, n) = -hPoly1.rightCols<1>();
         c.setZero();
         c(3) = -1.0;
 
-        const double minmaxsd = sdlp::linprog<4>(c, A, b, x);
+        const double minmaxsd = sdlp::linprog<4>(c, A.topRows(m + n), b.head(m + n), x);
 
         return minmaxsd < -eps && !std::isinf(minmaxsd);
     }
 
-    struct filterLess
+    // Axis-aligned box of an H-polytope by one LP per face of the box.
+    // An empty polytope gets lo > hi, an unbounded one infinite sides.
+    // The LPs are shuffled by a local engine, so they leave the stream
+    // of sdlp::linprog on the calling thread untouched.
+    inline void boundingBox(const Eigen::MatrixX4d &hPoly,
+                            Eigen::Vector3d &lo,
+                            Eigen::Vector3d &hi)
+    {
+        const int m = hPoly.rows();
+        thread_local Eigen::VectorXd b;
+        if (b.size() < m)
+        {
+            b.resize(m);
+        }
+        b.head(m) = -hPoly.col(3);
+        std::mt19937_64 gen(m);
+        Eigen::Vector3d c, x;
+        for (int k = 0; k < 3; k++)
+        {
+            c.setZero();
+            c(k) = 1.0;
+            lo(k) = sdlp::linprog<3>(c, hPoly.leftCols<3>(), b.head(m), x, gen);
+            c(k) = -1.0;
+            hi(k) = -sdlp::linprog<3>(c, hPoly.leftCols<3>(), b.head(m), x, gen);
+        }
+        return;
+    }
+
+    // Bounds of hPoly if every row has an axis-aligned normal and the
+    // polytope is bounded along all axes. Redundant rows are allowed,
+    // the tightest bound per direction is taken.
+    inline bool boxBounds(const Eigen::MatrixX4d &hPoly,
+                          Eigen::Vector3d &lo,
+                          Eigen::Vector3d &hi,
+                          const double epsilon = 1.0e-12)
     {
-        inline bool operator()(const Eigen::Vector3d &l,
-                               const Eigen::Vector3d &r) const
+        lo.setConstant(-INFINITY);
+        hi.setConstant(INFINITY);
+        const int m = hPoly.rows();
+        int k;
+        for (int i = 0; i < m; i++)
         {
-            return l(0) < r(0) ||
-                   (l(0) == r(0) &&
-                    (l(1) < r(1) ||
-                     (l(1) == r(1) &&
-                      l(2) < r(2))));
+            const double maxAbs = hPoly.row(i).head<3>().cwiseAbs().maxCoeff(&k);
+            if (maxAbs <= 0.0 ||
+                hPoly.row(i).head<3>().cwiseAbs().sum() - maxAbs > epsilon * maxAbs)
+            {
+                return false;
+            }
+            const double bound = -hPoly(i, 3) / hPoly(i, k);
+            if (hPoly(i, k) > 0.0)
+            {
+                hi(k) = std::min(hi(k), bound);
+            }
+            else
+            {
+                lo(k) = std::max(lo(k), bound);
+            }
+        }
+        return lo.allFinite() && hi.allFinite();
+    }
+
+    // The eight vertices of a box, false if it has no interior
+    inline bool enumerateBoxVs(const Eigen::Vector3d &lo,
+                               const Eigen::Vector3d &hi,
+                               Eigen::Matrix3Xd &vPoly)
+    {
+        if (!((hi - lo).minCoeff() > 0.0))
+        {
+            return false;
+        }
+        vPoly.resize(3, 8);
+        for (int i = 0; i < 8; i++)
+        {
+            vPoly(0, i) = (i & 1) ? hi(0) : lo(0);
+            vPoly(1, i) = (i & 2) ? hi(1) : lo(1);
+            vPoly(2, i) = (i & 4) ? hi(2) : lo(2);
+        }
+        return true;
+    }
+
+    // Vertex quantized to integer grid coordinates, tagged with its
+    // polytope and column
+    struct QuantizedV
+    {
+        int64_t key[3];
+        int poly;
+        int col;
+
+        inline bool operator<(const QuantizedV &r) const
+        {
+            return poly != r.poly ? poly < r.poly
+                   : key[0] != r.key[0] ? key[0] < r.key[0]
+                   : key[1] != r.key[1] ? key[1] < r.key[1]
+                   : key[2] != r.key[2] ? key[2] < r.key[2]
+                                        : col < r.col;
+        }
+
+        inline bool sameKey(const QuantizedV &r) const
+        {
+            return poly == r.poly && key[0] == r.key[0] &&
+                   key[1] == r.key[1] && key[2] == r.key[2];
         }
     };
 
-    inline void filterVs(const Eigen::Matrix3Xd &rV,
+    // Appends the quantized columns of rV to qs. Columns with a non-finite
+    // entry, as a degenerate hull yields, have no integer key, so only
+    // their keep flags are cleared.
+    inline void quantizeVs(const Eigen::Ref<const Eigen::Matrix3Xd> &rV,
+                           const double &epsilon,
+                           const int poly,
+                           char *keep,
+                           std::vector<QuantizedV> &qs)
+    {
+        double mag = 0.0;
+        for (int i = 0; i < rV.cols(); i++)
+        {
+            if (rV.col(i).allFinite())
+            {
+                mag = std::max(mag, rV.col(i).cwiseAbs().maxCoeff());
+            }
+            else
+            {
+                keep[i] = 0;
+            }
+        }
+        // All finite columns are zero when mag is, any resolution does
+        const double res = mag > 0.0 ? mag * std::max(fabs(epsilon) / mag, DBL_EPSILON) : 1.0;
+        QuantizedV q;
+        q.poly = poly;
+        for (int i = 0; i < rV.cols(); i++)
+        {
+            if (!keep[i])
+            {
+                continue;
+            }
+            for (int k = 0; k < 3; k++)
+            {
+                q.key[k] = (int64_t)std::round(rV(k, i) / res);
+            }
+            q.col = i;
+            qs.push_back(q);
+        }
+        return;
+    }
+
+    // Sorts qs and clears keep[offset(poly) + col] of every entry whose key
+    // already appeared in an earlier column of the same polytope
+    inline void markDuplicates(std::vector<QuantizedV> &qs,
+                               const std::vector<int> &offsets,
+                               std::vector<char> &keep)
+    {
+        std::sort(qs.begin(), qs.end());
+        for (size_t i = 1; i < qs.size(); i++)
+        {
+            if (qs[i].sameKey(qs[i - 1]))
+            {
+                keep[offsets[qs[i].poly] + qs[i].col] = 0;
+            }
+        }
+        return;
+    }
+
+    // Drops non-finite vertices and those that coincide with an earlier one
+    // up to epsilon, keeping the first of each in the original order
+    inline void filterVs(const Eigen::Ref<const Eigen::Matrix3Xd> &rV,
                          const double &epsilon,
                          Eigen::Matrix3Xd &fV)
     {
-        const double mag = std::max(fabs(rV.maxCoeff()), fabs(rV.minCoeff()));
-        const double res = mag * std::max(fabs(epsilon) / mag, DBL_EPSILON);
-        std::set<Eigen::Vector3d, filterLess> filter;
-        fV = rV;
-        int offset = 0;
-        Eigen::Vector3d quanti;
-        for (int i = 0; i < rV.cols(); i++)
+        // Grown on demand so that repeated calls do not allocate
+        thread_local std::vector<QuantizedV> qs;
+        thread_local std::vector<char> keep;
+        thread_local std::vector<int> offsets(1, 0);
+        qs.clear();
+        keep.assign(rV.cols(), 1);
+        quantizeVs(rV, epsilon, 0, keep.data(), qs);
+        markDuplicates(qs, offsets, keep);
+
+        fV.resize(3, std::count(keep.begin(), keep.end(), 1));
+        for (int i = 0, j = 0; i < rV.cols(); i++)
         {
-            quanti = (rV.col(i) / res).array().round();
-            if (filter.find(quanti) == filter.end())
+            if (keep[i])
             {
-                filter.insert(quanti);
-                fV.col(offset) = rV.col(i);
-                offset++;
+                fV.col(j++) = rV.col(i);
             }
         }
-        fV = fV.leftCols(offset).eval();
         return;
     }
 
-    // Each row of hPoly is defined by h0, h1, h2, h3 as
-    // h0*x + h1*y + h2*z + h3 <= 0
-    // proposed epsilon is 1.0e-6
-    inline void enumerateVs(const Eigen::MatrixX4d &hPoly,
-                            const Eigen::Vector3d &inner,
-                            Eigen::Matrix3Xd &vPoly,
-                            const double epsilon = 1.0e-6)
+    // filterVs of the vertex sets rVsAt(i) for i < num with a single sort
+    template <typename VsAt>
+    inline void filterVs(const int num,
+                         const VsAt &rVsAt,
+                         const double &epsilon,
+                         std::vector<Eigen::Matrix3Xd> &fVs)
     {
-        const Eigen::VectorXd b = -hPoly.rightCols<1>() - hPoly.leftCols<3>() * inner;
-        const Eigen::Matrix<double, 3, -1, Eigen::ColMajor> A =
-            (hPoly.leftCols<3>().array().colwise() / b.array()).transpose();
+        thread_local std::vector<QuantizedV> qs;
+        thread_local std::vector<char> keep;
+        thread_local std::vector<int> offsets;
+        qs.clear();
+        offsets.assign(num + 1, 0);
+        for (int i = 0; i < num; i++)
+        {
+            offsets[i + 1] = offsets[i] + rVsAt(i).cols();
+        }
+        keep.assign(offsets[num], 1);
+        for (int i = 0; i < num; i++)
+        {
+            quantizeVs(rVsAt(i), epsilon, i, keep.data() + offsets[i], qs);
+        }
+        markDuplicates(qs, offsets, keep);
 
+        fVs.resize(num);
+        for (int i = 0; i < num; i++)
+        {
+            const Eigen::Ref<const Eigen::Matrix3Xd> rV = rVsAt(i);
+            const char *kept = keep.data() + offsets[i];
+            fVs[i].resize(3, std::count(kept, kept + rV.cols(), 1));
+            for (int k = 0, j = 0; k < rV.cols(); k++)
+            {
+                if (kept[k])
+                {
+                    fVs[i].col(j++) = rV.col(k);
+                }
+            }
+        }
+        return;
+    }
+
+    // filterVs of every polytope of a corridor with a single sort
+    inline void filterVs(const std::vector<Eigen::Matrix3Xd> &rVs,
+                         const double &epsilon,
+                         std::vector<Eigen::Matrix3Xd> &fVs)
+    {
+        filterVs(
+            rVs.size(), [&](const int i) -> const Eigen::Matrix3Xd &
+            { return rVs[i]; },
+            epsilon, fVs);
+        return;
+    }
+
+    // Buffers of enumerateVs, grown on demand and kept between calls
+    struct VertexContext
+    {
+        Eigen::VectorXd b;
+        Eigen::Matrix3Xd A;
+        Eigen::Matrix3Xd rV;
         quickhull::QuickHull<double> qh;
+
+        // Room for a polytope of m rows, rV included
+        inline void reserve(const int m)
+        {
+            reserveDual(m);
+            if (rV.cols() < maxDualVs(m))
+            {
+                rV.resize(3, maxDualVs(m));
+            }
+        }
+
+        // Room for a polytope of m rows, without rV
+        inline void reserveDual(const int m)
+        {
+            if (b.size() < m)
+            {
+                b.resize(m);
+                A.resize(3, m);
+            }
+        }
+
+        // Room dualVs needs for a polytope of m rows, as the hull of m
+        // points has at most 2m - 4 triangles
+        static inline int maxDualVs(const int m)
+        {
+            return 2 * m;
+        }
+    };
+
+    // Context of the calling thread, used when none is given
+    inline VertexContext &vertex_context()
+    {
+        thread_local VertexContext ctx;
+        return ctx;
+    }
+
+    // Vertices of hPoly relative to its interior point inner, one per
+    // triangle of the hull of the dual points, so that a vertex is listed
+    // once per incident triangle. They are written to the first columns of
+    // rV, which has room for VertexContext::maxDualVs(hPoly.rows()), and
+    // their number is returned.
+    inline int dualVs(const Eigen::MatrixX4d &hPoly,
+                      const Eigen::Vector3d &inner,
+                      const double epsilon,
+                      Eigen::Ref<Eigen::Matrix3Xd> rV,
+                      VertexContext &ctx)
+    {
+        const int m = hPoly.rows();
+        ctx.reserveDual(m);
+        auto b = ctx.b.head(m);
+        b = -hPoly.col(3);
+        b.noalias() -= hPoly.leftCols<3>() * inner;
+        auto A = ctx.A.leftCols(m);
+        A = (hPoly.leftCols<3>().array().colwise() / b.array()).transpose();
+
         const double qhullEps = std::min(epsilon, quickhull::defaultEps<double>());
         // CCW is false because the normal in quickhull towards interior
-        const auto cvxHull = qh.getConvexHull(A.data(), A.cols(), false, true, qhullEps);
-        const auto &idBuffer = cvxHull.getIndexBuffer();
+        const auto &idBuffer = ctx.qh.getConvexHullIndices(A.data(), m, false, qhullEps);
         const int hNum = idBuffer.size() / 3;
-        Eigen::Matrix3Xd rV(3, hNum);
         Eigen::Vector3d normal, point, edge0, edge1;
         for (int i = 0; i < hNum; i++)
         {
@@ -149,8 +474,34 @@ namespace geo_utils
             normal = edge0.cross(edge1); //cross in CW gives an outter normal
             rV.col(i) = normal / normal.dot(point);
         }
-        filterVs(rV, epsilon, vPoly);
-        vPoly = (vPoly.array().colwise() + inner.array()).eval();
+        return hNum;
+    }
+
+    // Each row of hPoly is defined by h0, h1, h2, h3 as
+    // h0*x + h1*y + h2*z + h3 <= 0
+    // proposed epsilon is 1.0e-6
+    // ctx only holds buffers, so that a caller-owned one makes the
+    // enumeration reentrant
+    inline void enumerateVs(const Eigen::MatrixX4d &hPoly,
+                            const Eigen::Vector3d &inner,
+                            Eigen::Matrix3Xd &vPoly,
+                            const double epsilon,
+                            VertexContext &ctx)
+    {
+        ctx.reserve(hPoly.rows());
+        const int hNum = dualVs(hPoly, inner, epsilon, ctx.rV, ctx);
+        filterVs(ctx.rV.leftCols(hNum), epsilon, vPoly);
+        vPoly.colwise() += inner;
+        return;
+    }
+
+    // Same as above, using the buffers of the calling thread
+    inline void enumerateVs(const Eigen::MatrixX4d &hPoly,
+                            const Eigen::Vector3d &inner,
+                            Eigen::Matrix3Xd &vPoly,
+                            const double epsilon = 1.0e-6)
+    {
+        enumerateVs(hPoly, inner, vPoly, epsilon, vertex_context());
         return;
     }
 
@@ -173,6 +524,74 @@ namespace geo_utils
         }
     }
 
+    // Rows of a normalized hPoly that are facets of the polytope with
+    // vertices vPoly. A row touching fewer than three vertices is redundant,
+    // and of rows that agree up to epsilon only the first is kept. The
+    // tolerance is loose on purpose: keeping a redundant row costs time,
+    // dropping a facet would enlarge the corridor.
+    inline void compactFaces(const Eigen::MatrixX4d &hPoly,
+                             const Eigen::Ref<const Eigen::Matrix3Xd> &vPoly,
+                             Eigen::MatrixX4d &cPoly,
+                             const double epsilon = 1.0e-6)
+    {
+        const int m = hPoly.rows();
+        const int n = vPoly.cols();
+        if (n < 4)
+        {
+            // Degenerate enumeration, nothing can be decided from it
+            cPoly = hPoly;
+            return;
+        }
+
+        // Enumerated vertices carry the round-off of the dual hull, which
+        // exceeds epsilon, so a vertex counts as on a face in a wider band
+        const double onFaceSlack = 1.0e2;
+        const double scale = 1.0 + vPoly.cwiseAbs().maxCoeff();
+        const double onFace = std::max(onFaceSlack * epsilon, DBL_EPSILON) * scale;
+        const double sameNormal = std::max(epsilon, DBL_EPSILON);
+        const double sameOffset = std::max(epsilon, DBL_EPSILON) * scale;
+
+        // Grown on demand so that repeated calls do not allocate
+        thread_local std::vector<int> keep;
+        keep.resize(m);
+        int kept = 0;
+        for (int i = 0; i < m; i++)
+        {
+            int touching = 0;
+            for (int j = 0; j < n && touching < 3; j++)
+            {
+                touching += fabs(hPoly.row(i).head<3>().dot(vPoly.col(j)) + hPoly(i, 3)) <= onFace;
+            }
+            if (touching < 3)
+            {
+                continue;
+            }
+            bool duplicate = false;
+            for (int j = 0; j < kept && !duplicate; j++)
+            {
+                duplicate = (hPoly.row(i).head<3>() - hPoly.row(keep[j]).head<3>()).cwiseAbs().maxCoeff() <= sameNormal &&
+                            fabs(hPoly(i, 3) - hPoly(keep[j], 3)) <= sameOffset;
+            }
+            if (!duplicate)
+            {
+                keep[kept++] = i;
+            }
+        }
+
+        if (kept < 4)
+        {
+            // A bounded polytope has at least four facets
+            cPoly = hPoly;
+            return;
+        }
+        cPoly.resize(kept, 4);
+        for (int i = 0; i < kept; i++)
+        {
+            cPoly.row(i) = hPoly.row(keep[i]);
+        }
+        return;
+    }
+
 } // namespace geo_utils
 
 #endif
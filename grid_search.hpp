@@ -0,0 +1,437 @@
+#ifndef GRID_SEARCH_HPP
+#define GRID_SEARCH_HPP
+
+#include <Eigen/Eigen>
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace grid_search
+{
+
+    // A* over the 26-connected lattice of a fixed step spanning [lb, hb].
+    // Moves cost 10, 14 or 17 for one, two or three axes, so the octile
+    // heuristic is exact on an empty lattice and all priorities are small
+    // integers. Open nodes then live in a ring of buckets indexed by f.
+    // Nodes are created on first touch in an arena, with the map queried
+    // once per node. Their arena slots are found through a paged table
+    // whose pages are allocated on first touch, so memory follows the part
+    // of the lattice a search reaches rather than its size. The closed set
+    // is a bitmap paged the same way, one bit per lattice node. Every
+    // buffer is kept between searches and only the entries of touched
+    // nodes are reset afterwards, so a search costs nothing for the part
+    // it never reaches.
+    class GridAStar
+    {
+    public:
+        // Same contract as sfc_gen::planPath with the lattice step in
+        // place of the timeout: fills p from s to g and returns its length,
+        // or returns INFINITY and leaves p as is when there is no path.
+        // A diagonal move needs every lattice node of its unit cell free,
+        // so the path never cuts the corner of a blocked voxel. The
+        // segments joining s and g to the lattice are checked against the
+        // map too, see extract.
+        template <typename Map>
+        inline double search(const Eigen::Vector3d &s,
+                             const Eigen::Vector3d &g,
+                             const Eigen::Vector3d &lb,
+                             const Eigen::Vector3d &hb,
+                             const Map *mapPtr,
+                             const double step,
+                             std::vector<Eigen::Vector3d> &p)
+        {
+            if (!(step > 0.0) || !((hb - lb).array() >= 0.0).all())
+            {
+                return INFINITY;
+            }
+            const Eigen::Vector3d extent = ((hb - lb) / step).array().floor() + 1.0;
+            if (extent.prod() > (double)INT_MAX)
+            {
+                printf("GRID SEARCH WARNING: lattice of %.0f nodes is too large\n", extent.prod());
+                return INFINITY;
+            }
+            origin = lb;
+            res = step;
+            dims = extent.cast<int>();
+            const int pageNum = ((dims.prod() - 1) >> pageBits) + 1;
+            if ((int)pages.size() < pageNum)
+            {
+                pages.resize(pageNum);
+                closedPages.resize(pageNum);
+            }
+            setMoves();
+
+            const Eigen::Vector3i sc = nearest(s);
+            const Eigen::Vector3i gc = nearest(g);
+            const int goal = indexOf(gc);
+            arena.clear();
+            for (std::vector<int> &b : buckets)
+            {
+                b.clear();
+            }
+            queued = 0;
+            expansions = 0;
+
+            bool found = false;
+            const int start = touch(indexOf(sc), mapPtr);
+            if (!arena[start].blocked && !arena[touch(goal, mapPtr)].blocked)
+            {
+                arena[start].g = 0;
+                minF = heuristic(sc, gc);
+                push(start, minF);
+                int slot;
+                while (pop(slot))
+                {
+                    const int index = arena[slot].index;
+                    if (isClosed(index))
+                    {
+                        continue;
+                    }
+                    closedPages[index >> pageBits][(index & pageMask) >> 6] |= uint64_t(1) << (index & 63);
+                    if (index == goal)
+                    {
+                        found = true;
+                        break;
+                    }
+                    expansions++;
+                    expand(slot, gc, mapPtr);
+                }
+            }
+
+            double cost = INFINITY;
+            if (found)
+            {
+                cost = extract(s, g, goal, mapPtr, p);
+            }
+
+            for (const Node &n : arena)
+            {
+                pages[n.index >> pageBits][n.index & pageMask] = -1;
+                closedPages[n.index >> pageBits][(n.index & pageMask) >> 6] = 0;
+            }
+            return cost;
+        }
+
+        // Nodes expanded by the last search
+        inline int getExpansions() const
+        {
+            return expansions;
+        }
+
+    private:
+        struct Node
+        {
+            int index;
+            int parent;
+            int g;
+            bool blocked;
+        };
+
+        static constexpr int ringSize = 64;
+        // Pages of 4096 slots, a few rows of the lattice each
+        static constexpr int pageBits = 12;
+        static constexpr int pageMask = (1 << pageBits) - 1;
+
+        Eigen::Vector3d origin = Eigen::Vector3d::Zero();
+        double res = 1.0;
+        Eigen::Vector3i dims = Eigen::Vector3i::Ones();
+        std::vector<Node> arena;
+        // Arena slot of every lattice node, -1 if untouched
+        std::vector<std::vector<int>> pages;
+        // Closed bit of every lattice node, paged along with pages
+        std::vector<std::vector<uint64_t>> closedPages;
+        std::vector<int> buckets[ringSize];
+        std::vector<int> chain;
+        std::vector<Eigen::Vector3d> turns;
+        int minF = 0;
+        int queued = 0;
+        int expansions = 0;
+
+        Eigen::Vector3i moveDir[26];
+        int moveOffset[26];
+        int moveCost[26];
+
+        inline void setMoves()
+        {
+            int k = 0;
+            for (int dz = -1; dz <= 1; dz++)
+            {
+                for (int dy = -1; dy <= 1; dy++)
+                {
+                    for (int dx = -1; dx <= 1; dx++)
+                    {
+                        const int axes = (dx != 0) + (dy != 0) + (dz != 0);
+                        if (axes == 0)
+                        {
+                            continue;
+                        }
+                        moveDir[k] = Eigen::Vector3i(dx, dy, dz);
+                        moveOffset[k] = (dz * dims(1) + dy) * dims(0) + dx;
+                        moveCost[k] = axes == 1 ? 10 : (axes == 2 ? 14 : 17);
+                        k++;
+                    }
+                }
+            }
+            return;
+        }
+
+        // Table entry of a node, its page is allocated on first use
+        inline int &slotOf(const int index)
+        {
+            std::vector<int> &page = pages[index >> pageBits];
+            if (page.empty())
+            {
+                page.resize(1 << pageBits, -1);
+                closedPages[index >> pageBits].resize(1 << (pageBits - 6), 0);
+            }
+            return page[index & pageMask];
+        }
+
+        inline bool isClosed(const int index) const
+        {
+            const std::vector<uint64_t> &page = closedPages[index >> pageBits];
+            return !page.empty() &&
+                   (page[(index & pageMask) >> 6] >> (index & 63) & 1) != 0;
+        }
+
+        inline Eigen::Vector3i nearest(const Eigen::Vector3d &x) const
+        {
+            const Eigen::Vector3i c = ((x - origin) / res).array().round().cast<int>();
+            return c.cwiseMax(0).cwiseMin(dims - Eigen::Vector3i::Ones());
+        }
+
+        inline int indexOf(const Eigen::Vector3i &c) const
+        {
+            return (c(2) * dims(1) + c(1)) * dims(0) + c(0);
+        }
+
+        inline Eigen::Vector3i coordOf(const int index) const
+        {
+            return Eigen::Vector3i(index % dims(0),
+                                   (index / dims(0)) % dims(1),
+                                   index / (dims(0) * dims(1)));
+        }
+
+        inline Eigen::Vector3d position(const int index) const
+        {
+            return origin + res * coordOf(index).cast<double>();
+        }
+
+        // Cost of the cheapest move sequence on an empty lattice
+        static inline int heuristic(const Eigen::Vector3i &a,
+                                    const Eigen::Vector3i &b)
+        {
+            int d[3] = {std::abs(a(0) - b(0)), std::abs(a(1) - b(1)), std::abs(a(2) - b(2))};
+            std::sort(d, d + 3);
+            return 17 * d[0] + 14 * (d[1] - d[0]) + 10 * (d[2] - d[1]);
+        }
+
+        // Arena slot of a node, created with one map query on first touch
+        template <typename Map>
+        inline int touch(const int index, const Map *mapPtr)
+        {
+            int &slot = slotOf(index);
+            if (slot < 0)
+            {
+                slot = arena.size();
+                arena.push_back(Node{index, -1, INT_MAX, mapPtr->query(position(index)) != 0});
+            }
+            return slot;
+        }
+
+        // f never drops below that of the node being expanded and grows by
+        // at most twice the largest move cost, so the ring never wraps
+        inline void push(const int slot, const int f)
+        {
+            buckets[f % ringSize].push_back(slot);
+            queued++;
+            return;
+        }
+
+        inline bool pop(int &slot)
+        {
+            if (queued == 0)
+            {
+                return false;
+            }
+            while (buckets[minF % ringSize].empty())
+            {
+                minF++;
+            }
+            std::vector<int> &b = buckets[minF % ringSize];
+            slot = b.back();
+            b.pop_back();
+            queued--;
+            return true;
+        }
+
+        template <typename Map>
+        inline void expand(const int slot,
+                           const Eigen::Vector3i &gc,
+                           const Map *mapPtr)
+        {
+            const int index = arena[slot].index;
+            const int gCur = arena[slot].g;
+            const Eigen::Vector3i c = coordOf(index);
+            for (int k = 0; k < 26; k++)
+            {
+                const Eigen::Vector3i n = c + moveDir[k];
+                if ((n.array() < 0).any() || (n.array() >= dims.array()).any())
+                {
+                    continue;
+                }
+                const int next = index + moveOffset[k];
+                if (isClosed(next) || !cellFree(index, moveDir[k], mapPtr))
+                {
+                    continue;
+                }
+                const int ns = touch(next, mapPtr);
+                const int ng = gCur + moveCost[k];
+                if (!arena[ns].blocked && ng < arena[ns].g)
+                {
+                    arena[ns].g = ng;
+                    arena[ns].parent = slot;
+                    push(ns, ng + heuristic(n, gc));
+                }
+            }
+            return;
+        }
+
+        // Whether the nodes strictly between index and index + dir on the
+        // unit cell they span are free. Straight moves have none.
+        template <typename Map>
+        inline bool cellFree(const int index,
+                             const Eigen::Vector3i &dir,
+                             const Map *mapPtr)
+        {
+            const int stride[3] = {1, dims(0), dims(0) * dims(1)};
+            int partial[3], num = 0;
+            for (int a = 0; a < 3; a++)
+            {
+                if (dir(a) != 0)
+                {
+                    partial[num++] = dir(a) * stride[a];
+                }
+            }
+            // Proper nonempty subsets of the moved axes
+            for (int mask = 1; mask < (1 << num) - 1; mask++)
+            {
+                int other = index;
+                for (int a = 0; a < num; a++)
+                {
+                    if (mask & (1 << a))
+                    {
+                        other += partial[a];
+                    }
+                }
+                if (arena[touch(other, mapPtr)].blocked)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Whether the map is free along the segment from a to b, queried
+        // at both ends and at most half a step apart in between
+        template <typename Map>
+        inline bool segmentFree(const Eigen::Vector3d &a,
+                                const Eigen::Vector3d &b,
+                                const Map *mapPtr) const
+        {
+            const int num = std::max(1, (int)std::ceil(2.0 * (b - a).norm() / res));
+            for (int i = 0; i <= num; i++)
+            {
+                if (mapPtr->query(a + (b - a) * (double(i) / num)) != 0)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Lattice path from s to g with the nodes inside straight runs
+        // dropped. s and g take the place of the first and last lattice
+        // nodes when the segments to their neighbours in the path are
+        // free, which no move has checked. Otherwise the lattice node is
+        // kept and the short hop from s or to g has to be free, or the
+        // search fails after all.
+        template <typename Map>
+        inline double extract(const Eigen::Vector3d &s,
+                              const Eigen::Vector3d &g,
+                              const int goal,
+                              const Map *mapPtr,
+                              std::vector<Eigen::Vector3d> &p)
+        {
+            chain.clear();
+            for (int slot = slotOf(goal); slot != -1; slot = arena[slot].parent)
+            {
+                chain.push_back(arena[slot].index);
+            }
+            std::reverse(chain.begin(), chain.end());
+
+            turns.clear();
+            turns.push_back(s);
+            for (size_t i = 1; i + 1 < chain.size(); i++)
+            {
+                if (coordOf(chain[i]) - coordOf(chain[i - 1]) !=
+                    coordOf(chain[i + 1]) - coordOf(chain[i]))
+                {
+                    turns.push_back(position(chain[i]));
+                }
+            }
+
+            const Eigen::Vector3d first = position(chain.front());
+            const Eigen::Vector3d last = position(chain.back());
+            if (!segmentFree(s, turns.size() > 1 ? turns[1] : g, mapPtr))
+            {
+                if (!segmentFree(s, first, mapPtr))
+                {
+                    return INFINITY;
+                }
+                turns.insert(turns.begin() + 1, first);
+            }
+            if (!segmentFree(turns.back(), g, mapPtr))
+            {
+                if (!segmentFree(last, g, mapPtr))
+                {
+                    return INFINITY;
+                }
+                if (turns.back() != last)
+                {
+                    turns.push_back(last);
+                }
+            }
+            turns.push_back(g);
+
+            p = turns;
+            double length = 0.0;
+            for (size_t i = 1; i < p.size(); i++)
+            {
+                length += (p[i] - p[i - 1]).norm();
+            }
+            return length;
+        }
+    };
+
+    // GridAStar::search on a search object kept per thread
+    template <typename Map>
+    inline double planPath(const Eigen::Vector3d &s,
+                           const Eigen::Vector3d &g,
+                           const Eigen::Vector3d &lb,
+                           const Eigen::Vector3d &hb,
+                           const Map *mapPtr,
+                           const double &step,
+                           std::vector<Eigen::Vector3d> &p)
+    {
+        thread_local GridAStar astar;
+        return astar.search(s, g, lb, hb, mapPtr, step, p);
+    }
+
+}
+
+#endif
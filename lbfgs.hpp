@@ -258,6 +258,18 @@ namespace lbfgs
         lbfgs_progress_t proc_progress = nullptr;
     };
 
+    /**
+     * Intermediate vectors and limited memory of lbfgs_optimize().
+     * Passing the same workspace to repeated calls of a fixed problem
+     * size avoids any heap allocation inside the optimizer.
+     */
+    struct lbfgs_workspace_t
+    {
+        Eigen::VectorXd xp, g, gp, d, pf;
+        Eigen::VectorXd lm_alpha, lm_ys;
+        Eigen::MatrixXd lm_s, lm_y;
+    };
+
     // ----------------------- L-BFGS Part -----------------------
 
     /**
@@ -427,6 +439,8 @@ namespace lbfgs
      *  @param  instance        A user data pointer for client programs. The callback
      *                          functions will receive the value of this argument.
      *  @param  param           The parameters for L-BFGS optimization.
+     *  @param  work            The buffers used by the optimizer, resized to
+     *                          the problem and reusable across calls.
      *  @retval int             The status code. This function returns a nonnegative 
      *                          integer if the minimization process terminates without 
      *                          an error. A negative integer indicates an error.
@@ -437,7 +451,8 @@ namespace lbfgs
                               lbfgs_stepbound_t proc_stepbound,
                               lbfgs_progress_t proc_progress,
                               void *instance,
-                              const lbfgs_parameter_t &param)
+                              const lbfgs_parameter_t &param,
+                              lbfgs_workspace_t &work)
     {
         int ret, i, j, k, ls, end, bound;
         double step, step_min, step_max, fx, ys, yy;
@@ -495,17 +510,26 @@ namespace lbfgs
         }
 
         /* Prepare intermediate variables. */
-        Eigen::VectorXd xp(n);
-        Eigen::VectorXd g(n);
-        Eigen::VectorXd gp(n);
-        Eigen::VectorXd d(n);
-        Eigen::VectorXd pf(std::max(1, param.past));
+        Eigen::VectorXd &xp = work.xp;
+        Eigen::VectorXd &g = work.g;
+        Eigen::VectorXd &gp = work.gp;
+        Eigen::VectorXd &d = work.d;
+        Eigen::VectorXd &pf = work.pf;
+        xp.resize(n);
+        g.resize(n);
+        gp.resize(n);
+        d.resize(n);
+        pf.resize(std::max(1, param.past));
 
         /* Initialize the limited memory. */
-        Eigen::VectorXd lm_alpha = Eigen::VectorXd::Zero(m);
-        Eigen::MatrixXd lm_s = Eigen::MatrixXd::Zero(n, m);
-        Eigen::MatrixXd lm_y = Eigen::MatrixXd::Zero(n, m);
-        Eigen::VectorXd lm_ys = Eigen::VectorXd::Zero(m);
+        Eigen::VectorXd &lm_alpha = work.lm_alpha;
+        Eigen::MatrixXd &lm_s = work.lm_s;
+        Eigen::MatrixXd &lm_y = work.lm_y;
+        Eigen::VectorXd &lm_ys = work.lm_ys;
+        lm_alpha.setZero(m);
+        lm_s.setZero(n, m);
+        lm_y.setZero(n, m);
+        lm_ys.setZero(m);
 
         /* Construct a callback data. */
         callback_data_t cd;
@@ -716,6 +740,22 @@ namespace lbfgs
         return ret;
     }
 
+    /**
+     * Start a L-BFGS optimization with a workspace local to this call.
+     */
+    inline int lbfgs_optimize(Eigen::VectorXd &x,
+                              double &f,
+                              lbfgs_evaluate_t proc_evaluate,
+                              lbfgs_stepbound_t proc_stepbound,
+                              lbfgs_progress_t proc_progress,
+                              void *instance,
+                              const lbfgs_parameter_t &param)
+    {
+        lbfgs_workspace_t work;
+        return lbfgs_optimize(x, f, proc_evaluate, proc_stepbound,
+                              proc_progress, instance, param, work);
+    }
+
     /**
      * Get string description of an lbfgs_optimize() return code.
      *
@@ -195,6 +195,20 @@ double* return_acc(double time, const Eigen::Matrix<double, 3, 4> &coeff_matrix)
 
         //cout << "SFC optimization finished, cost = " << cost << "\n";
 
+        const gcopter::PlannerStats &stats = sfc.getStats();
+        std::cout << "Setup: " << stats.setupTime * 1.0e6 << " us"
+                  << " (corridor " << stats.processCorridorTime * 1.0e6
+                  << ", shortest path " << stats.shortestPathTime * 1.0e6 << ")\n"
+                  << "Optimize: " << stats.optimizeTime * 1.0e6 << " us"
+                  << " (backwardP " << stats.backwardPTime * 1.0e6
+                  << ", minco " << stats.mincoTime * 1.0e6
+                  << ", penalty " << stats.penaltyTime * 1.0e6
+                  << ", swarm " << stats.swarmPenaltyTime * 1.0e6
+                  << ", adjoint " << stats.adjointTime * 1.0e6 << ")\n"
+                  << "Iterations: " << stats.iterations
+                  << ", line-search trials: " << stats.lineSearchTrials
+                  << ", cost evaluations: " << stats.costEvaluations << std::endl;
+
         // Use the returned Trajectory to get durations, junctions and coefficients
         int pieceNum = traj.getPieceNum();
         if (pieceNum == 0) {
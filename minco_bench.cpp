@@ -0,0 +1,1181 @@
+// Microbenchmarks of the numerical kernels used by GCOPTER.
+//
+// Usage: minco_bench [--filter <substring>] [--min-time <seconds>] [--out <file.json>]
+//        minco_bench --check
+//
+// Every kernel is run on a few problem sizes. Each case is warmed up,
+// then sampled until min-time has elapsed (at least 10 and at most
+// 10000 samples). The median / p99 latency and the number of heap
+// allocations per call are written as JSON to stdout or --out.
+//
+// With --check, only the regression checks of the kernels are run, and
+// the exit status is the number of failed checks.
+
+#include "gcopter.hpp"
+#include "minco.hpp"
+#include "flatness.hpp"
+#include "sdlp.hpp"
+#include "geo_utils.hpp"
+#include "firi.hpp"
+#include "root_finder.hpp"
+#include "lbfgs.hpp"
+#include "trajectory.hpp"
+#include "voxel_map.hpp"
+#include "grid_search.hpp"
+#include "point_cloud.hpp"
+#include "point_index.hpp"
+#include "sfc_gen.hpp"
+
+#include <Eigen/Eigen>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+// Count heap allocations by interposing the C allocator, which also
+// catches Eigen's aligned_malloc that bypasses operator new
+static std::atomic<unsigned long long> allocCount(0);
+
+#ifdef __GLIBC__
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t num, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+
+    void *malloc(size_t size)
+    {
+        allocCount.fetch_add(1, std::memory_order_relaxed);
+        return __libc_malloc(size);
+    }
+
+    void *calloc(size_t num, size_t size)
+    {
+        allocCount.fetch_add(1, std::memory_order_relaxed);
+        return __libc_calloc(num, size);
+    }
+
+    void *realloc(void *ptr, size_t size)
+    {
+        allocCount.fetch_add(1, std::memory_order_relaxed);
+        return __libc_realloc(ptr, size);
+    }
+}
+#else
+void *operator new(size_t size)
+{
+    allocCount.fetch_add(1, std::memory_order_relaxed);
+    void *ptr = std::malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+#endif
+
+namespace bench
+{
+
+    struct Options
+    {
+        std::string filter;
+        double minTime = 0.2;
+        std::string out;
+    };
+
+    struct Result
+    {
+        std::string name;
+        int size;
+        int samples;
+        double median;
+        double p99;
+        double mean;
+        double allocs;
+    };
+
+    // Times func() repeatedly, latencies are reported in microseconds
+    template <typename F>
+    inline void run(const Options &opts,
+                    const std::string &name,
+                    const int size,
+                    F &&func,
+                    std::vector<Result> &results)
+    {
+        if (!opts.filter.empty() && name.find(opts.filter) == std::string::npos)
+        {
+            return;
+        }
+
+        const auto warm = std::chrono::steady_clock::now();
+        func();
+        const double once = std::chrono::duration<double>(
+                                std::chrono::steady_clock::now() - warm)
+                                .count();
+        const int samples = std::max(10, std::min(10000, (int)(opts.minTime / std::max(once, 1.0e-9))));
+
+        std::vector<double> lat(samples);
+        const unsigned long long allocStart = allocCount.load();
+        for (int i = 0; i < samples; i++)
+        {
+            const auto t0 = std::chrono::steady_clock::now();
+            func();
+            const auto t1 = std::chrono::steady_clock::now();
+            lat[i] = std::chrono::duration<double, std::micro>(t1 - t0).count();
+        }
+        // The latency buffer is preallocated, so every allocation belongs to func
+        const unsigned long long allocs = allocCount.load() - allocStart;
+
+        Result res;
+        res.name = name;
+        res.size = size;
+        res.samples = samples;
+        res.mean = 0.0;
+        for (const double l : lat)
+        {
+            res.mean += l;
+        }
+        res.mean /= samples;
+        std::sort(lat.begin(), lat.end());
+        res.median = lat[samples / 2];
+        res.p99 = lat[std::min(samples - 1, (int)std::ceil(0.99 * samples) - 1)];
+        res.allocs = (double)allocs / samples;
+        results.push_back(res);
+
+        std::fprintf(stderr, "%-28s %6d  median %12.3f us  p99 %12.3f us  allocs %8.1f\n",
+                     name.c_str(), size, res.median, res.p99, res.allocs);
+        return;
+    }
+
+    // Keeps results alive so the optimizer cannot drop the work
+    static volatile double sink;
+
+    inline Eigen::MatrixX4d boxH(const Eigen::Vector3d &lo,
+                                 const Eigen::Vector3d &hi)
+    {
+        Eigen::MatrixX4d hPoly(6, 4);
+        hPoly << 1.0, 0.0, 0.0, -hi(0),
+            -1.0, 0.0, 0.0, lo(0),
+            0.0, 1.0, 0.0, -hi(1),
+            0.0, -1.0, 0.0, lo(1),
+            0.0, 0.0, 1.0, -hi(2),
+            0.0, 0.0, -1.0, lo(2);
+        return hPoly;
+    }
+
+    // A wavy path of n pieces with one second per piece
+    inline void wavyPath(const int n,
+                         std::mt19937_64 &gen,
+                         Eigen::Matrix3d &head,
+                         Eigen::Matrix3d &tail,
+                         Eigen::Matrix3Xd &inPs,
+                         Eigen::VectorXd &ts)
+    {
+        std::uniform_real_distribution<double> jitter(-0.2, 0.2);
+        head.setZero();
+        tail.setZero();
+        tail(0, 0) = n;
+        inPs.resize(3, n - 1);
+        for (int i = 0; i < n - 1; i++)
+        {
+            inPs.col(i) << i + 1.0, std::sin(0.5 * (i + 1)) + jitter(gen), jitter(gen);
+        }
+        ts = Eigen::VectorXd::Constant(n, 1.0);
+        return;
+    }
+
+    inline void benchMinco(const Options &opts, std::vector<Result> &results)
+    {
+        std::mt19937_64 gen(1);
+        for (const int n : {8, 32, 128, 512})
+        {
+            Eigen::Matrix3d head, tail;
+            Eigen::Matrix3Xd inPs;
+            Eigen::VectorXd ts;
+            wavyPath(n, gen, head, tail, inPs, ts);
+
+            minco::MINCO_S2NU minco;
+            minco.setConditions(head, tail, n);
+            run(opts, "minco.setParameters", n, [&]()
+                { minco.setParameters(inPs, ts);
+                  sink = minco.getCoeffs()(0, 0); },
+                results);
+
+            minco.setParameters(inPs, ts);
+            Eigen::MatrixX3d gdC;
+            Eigen::VectorXd gdT;
+            minco.getEnergyPartialGradByCoeffs(gdC);
+            minco.getEnergyPartialGradByTimes(gdT);
+            Eigen::Matrix3Xd gradByPoints;
+            Eigen::VectorXd gradByTimes;
+            run(opts, "minco.propogateGrad", n, [&]()
+                { minco.propogateGrad(gdC, gdT, gradByPoints, gradByTimes);
+                  sink = gradByTimes(0); },
+                results);
+        }
+        return;
+    }
+
+    inline void benchPenalty(const Options &opts, std::vector<Result> &results)
+    {
+        std::mt19937_64 gen(2);
+        Eigen::VectorXd magnitudeBounds(5), penaltyWeights(5), physicalParams(6);
+        magnitudeBounds << 4.0, 2.1, 1.05, 2.0, 12.0;
+        penaltyWeights << 1.0e4, 1.0e4, 1.0e4, 1.0e4, 1.0e5;
+        physicalParams << 0.61, 9.8, 0.70, 0.80, 0.01, 0.0001;
+        flatness::FlatnessMap flatMap;
+        flatMap.reset(physicalParams(0), physicalParams(1), physicalParams(2),
+                      physicalParams(3), physicalParams(4), physicalParams(5));
+
+        for (const int n : {8, 32, 128})
+        {
+            Eigen::Matrix3d head, tail;
+            Eigen::Matrix3Xd inPs;
+            Eigen::VectorXd ts;
+            wavyPath(n, gen, head, tail, inPs, ts);
+            minco::MINCO_S2NU minco;
+            minco.setConditions(head, tail, n);
+            minco.setParameters(inPs, ts);
+
+            // One thin box per piece so that part of the samples violate it
+            gcopter::GCOPTER_PolytopeSFC::PolyhedraH hPolys;
+            Eigen::VectorXi hIdx(n);
+            for (int i = 0; i < n; i++)
+            {
+                hPolys.push_back(boxH(Eigen::Vector3d(i - 0.5, -1.0, -0.5),
+                                      Eigen::Vector3d(i + 1.5, 1.0, 0.5)));
+                hIdx(i) = i;
+            }
+
+            Eigen::VectorXd gradT = Eigen::VectorXd::Zero(n);
+            Eigen::MatrixX3d gradC = Eigen::MatrixX3d::Zero(4 * n, 3);
+            gcopter::detail::CorridorFaces faces;
+            gcopter::detail::getCorridorFaces(hPolys, faces);
+            run(opts, "gcopter.penalty", n, [&]()
+                { double cost = 0.0;
+                  gcopter::detail::attachPenaltyFunctional(
+                      ts, minco.getCoeffs(), hIdx, faces, 1.0e-2, 16,
+                      magnitudeBounds, penaltyWeights, flatMap,
+                      cost, gradT, gradC);
+                  sink = cost; },
+                results);
+
+            std::vector<Trajectory<3>> otherAgents(2);
+            for (int k = 0; k < 2; k++)
+            {
+                Eigen::Matrix3Xd otherPs = inPs;
+                otherPs.row(1).array() += 0.3 * (k + 1);
+                minco.setParameters(otherPs, ts);
+                minco.getTrajectory(otherAgents[k]);
+            }
+            minco.setParameters(inPs, ts);
+            run(opts, "gcopter.swarmPenalty", n, [&]()
+                { double cost = 0.0;
+                  gcopter::detail::attachSwarmPenaltyFunctional(
+                      ts, minco.getCoeffs(), hIdx, hPolys, 1.0e-2, 16,
+                      1.0, Eigen::Matrix3d::Identity(), otherAgents,
+                      cost, gradT, gradC);
+                  sink = cost; },
+                results);
+        }
+        return;
+    }
+
+    // Setup of a corridor of overlapping boxes, through the interior LP
+    // and QuickHull and with the closed-form box path
+    inline void benchSetup(const Options &opts, std::vector<Result> &results)
+    {
+        Eigen::VectorXd magnitudeBounds(5), penaltyWeights(5), physicalParams(6);
+        magnitudeBounds << 4.0, 2.1, 1.05, 2.0, 12.0;
+        penaltyWeights << 1.0e4, 1.0e4, 1.0e4, 1.0e4, 1.0e5;
+        physicalParams << 0.61, 9.8, 0.70, 0.80, 0.01, 0.0001;
+
+        for (const int n : {8, 32})
+        {
+            gcopter::GCOPTER_PolytopeSFC::PolyhedraH hPolys;
+            for (int i = 0; i < n; i++)
+            {
+                const double y = std::sin(0.5 * i);
+                hPolys.push_back(boxH(Eigen::Vector3d(i - 0.5, y - 1.0, -0.5),
+                                      Eigen::Vector3d(i + 1.5, y + 1.0, 0.5)));
+            }
+            Eigen::Matrix3d head, tail;
+            head.setZero();
+            tail.setZero();
+            tail.col(0) << n, std::sin(0.5 * (n - 1)), 0.0;
+
+            for (const bool box : {false, true})
+            {
+                gcopter::GCOPTER_PolytopeSFC planner;
+                // Every call enumerates all polytopes again
+                planner.setVertexCacheCapacity(0);
+                planner.setBoxCorridor(box);
+                run(opts, box ? "gcopter.setupBox" : "gcopter.setup", n, [&]()
+                    { sink = planner.setup(1.0, head, tail, hPolys, 0.5, 1.0e-2, 16,
+                                           magnitudeBounds, penaltyWeights, physicalParams); },
+                    results);
+            }
+        }
+        return;
+    }
+
+    inline void benchFlatness(const Options &opts, std::vector<Result> &results)
+    {
+        std::mt19937_64 gen(3);
+        std::uniform_real_distribution<double> uni(-2.0, 2.0);
+        flatness::FlatnessMap flatMap;
+        flatMap.reset(0.61, 9.8, 0.70, 0.80, 0.01, 0.0001);
+
+        for (const int n : {1, 64, 4096})
+        {
+            std::vector<Eigen::Vector3d> vel(n), acc(n), jer(n);
+            for (int i = 0; i < n; i++)
+            {
+                vel[i] << uni(gen), uni(gen), uni(gen);
+                acc[i] << uni(gen), uni(gen), uni(gen);
+                jer[i] << uni(gen), uni(gen), uni(gen);
+            }
+
+            double thr;
+            Eigen::Vector4d quat;
+            Eigen::Vector3d omg;
+            run(opts, "flatness.forward", n, [&]()
+                { double acc_sum = 0.0;
+                  for (int i = 0; i < n; i++)
+                  {
+                      flatMap.forward(vel[i], acc[i], jer[i], 0.0, 0.0, thr, quat, omg);
+                      acc_sum += thr;
+                  }
+                  sink = acc_sum; },
+                results);
+
+            const Eigen::Vector3d posGrad(0.1, 0.2, 0.3), velGrad(0.3, 0.2, 0.1);
+            const Eigen::Vector4d quatGrad(0.1, -0.1, 0.2, -0.2);
+            const Eigen::Vector3d omgGrad(0.5, 0.4, 0.3);
+            Eigen::Vector3d posTotal, velTotal, accTotal, jerTotal;
+            double psiTotal, dpsiTotal;
+            run(opts, "flatness.forwardBackward", n, [&]()
+                { double acc_sum = 0.0;
+                  for (int i = 0; i < n; i++)
+                  {
+                      flatMap.forward(vel[i], acc[i], jer[i], 0.0, 0.0, thr, quat, omg);
+                      flatMap.backward(posGrad, velGrad, 1.0, quatGrad, omgGrad,
+                                       posTotal, velTotal, accTotal, jerTotal,
+                                       psiTotal, dpsiTotal);
+                      acc_sum += accTotal(0);
+                  }
+                  sink = acc_sum; },
+                results);
+        }
+        return;
+    }
+
+    inline void benchGeometry(const Options &opts, std::vector<Result> &results)
+    {
+        std::mt19937_64 gen(4);
+        std::normal_distribution<double> normal(0.0, 1.0);
+
+        // Random tangent planes of the unit sphere, bounded by a box
+        for (const int m : {16, 256, 4096})
+        {
+            Eigen::Matrix<double, -1, 4> A(m + 8, 4);
+            Eigen::VectorXd b(m + 8);
+            for (int i = 0; i < m; i++)
+            {
+                Eigen::Vector4d dir(normal(gen), normal(gen), normal(gen), normal(gen));
+                A.row(i) = dir.normalized().transpose();
+                b(i) = 1.0;
+            }
+            A.bottomRows<8>() << Eigen::Matrix4d::Identity(), -Eigen::Matrix4d::Identity();
+            b.tail<8>().setConstant(2.0);
+            const Eigen::Vector4d c(1.0, -0.5, 0.25, 0.75);
+            Eigen::Vector4d x;
+            std::mt19937_64 lpGen(5);
+            run(opts, "sdlp.linprog4", m, [&]()
+                { sink = sdlp::linprog<4>(c, A, b, x, lpGen); },
+                results);
+        }
+
+        // Interior points of a corridor worth of small polytopes in one call
+        for (const int n : {8, 64})
+        {
+            std::vector<Eigen::MatrixX4d> hPolys(n, Eigen::MatrixX4d(24, 4));
+            std::vector<std::mt19937_64> gens(n);
+            for (int k = 0; k < n; k++)
+            {
+                for (int i = 0; i < 24; i++)
+                {
+                    Eigen::Vector3d dir(normal(gen), normal(gen), normal(gen));
+                    hPolys[k].row(i) << dir.normalized().transpose(), -1.0 - 0.1 * k;
+                }
+                gens[k].seed(k);
+            }
+            std::vector<Eigen::Vector3d> interiors;
+            std::vector<char> found;
+            run(opts, "geo_utils.findInteriors", n, [&]()
+                { geo_utils::findInteriors(
+                      n, [&](const int i) -> const Eigen::MatrixX4d &
+                      { return hPolys[i]; },
+                      gens, interiors, found);
+                  sink = found[0]; },
+                results);
+        }
+
+        // Intersection of two boxes, the general way and in closed form
+        {
+            Eigen::MatrixX4d inter(12, 4);
+            inter << boxH(Eigen::Vector3d(0.0, -1.0, -0.5), Eigen::Vector3d(2.0, 1.0, 0.5)),
+                boxH(Eigen::Vector3d(1.0, -0.5, -1.0), Eigen::Vector3d(3.0, 1.5, 1.0));
+            Eigen::Matrix3Xd vPoly;
+            run(opts, "geo_utils.enumerateVsBox", 12, [&]()
+                { geo_utils::enumerateVs(inter, vPoly);
+                  sink = vPoly.cols(); },
+                results);
+            Eigen::Vector3d lo, hi;
+            run(opts, "geo_utils.enumerateBoxVs", 12, [&]()
+                { geo_utils::boxBounds(inter, lo, hi);
+                  geo_utils::enumerateBoxVs(lo, hi, vPoly);
+                  sink = vPoly.cols(); },
+                results);
+        }
+
+        for (const int m : {16, 64, 256})
+        {
+            Eigen::MatrixX4d hPoly(m, 4);
+            for (int i = 0; i < m; i++)
+            {
+                Eigen::Vector3d dir(normal(gen), normal(gen), normal(gen));
+                hPoly.row(i) << dir.normalized().transpose(), -1.0;
+            }
+            // Hull of the dual points alone, as enumerateVs builds it
+            const Eigen::Matrix3Xd dual = hPoly.leftCols<3>().transpose();
+            quickhull::QuickHull<double> qh;
+            run(opts, "quickhull.indices", m, [&]()
+                { sink = qh.getConvexHullIndices(dual.data(), m, false).size(); },
+                results);
+
+            Eigen::Matrix3Xd vPoly;
+            run(opts, "geo_utils.enumerateVs", m, [&]()
+                { geo_utils::enumerateVs(hPoly, Eigen::Vector3d::Zero(), vPoly);
+                  sink = vPoly.cols(); },
+                results);
+        }
+
+        // Hull vertices come out once per incident facet, so about a third
+        // of the raw columns survive the deduplication
+        for (const int n : {8, 32})
+        {
+            std::vector<Eigen::Matrix3Xd> rVs(n);
+            for (int k = 0; k < n; k++)
+            {
+                const Eigen::Matrix3Xd vs = Eigen::Matrix3Xd::Random(3, 32);
+                rVs[k].resize(3, 96);
+                for (int i = 0; i < 96; i++)
+                {
+                    rVs[k].col(i) = vs.col((i * 7) % 32) +
+                                    Eigen::Vector3d::Constant(1.0e-9 * normal(gen));
+                }
+            }
+            std::vector<Eigen::Matrix3Xd> fVs;
+            run(opts, "geo_utils.filterVs", n, [&]()
+                { geo_utils::filterVs(rVs, 1.0e-6, fVs);
+                  sink = fVs[0].cols(); },
+                results);
+        }
+
+        for (const int n : {16, 64, 256})
+        {
+            // Random tangent planes of the unit sphere
+            Eigen::MatrixX4d hPoly(n, 4);
+            for (int i = 0; i < n; i++)
+            {
+                hPoly.row(i).head<3>() = Eigen::Vector3d(normal(gen), normal(gen), normal(gen)).normalized();
+                hPoly(i, 3) = -1.0;
+            }
+            Eigen::Matrix3d R;
+            Eigen::Vector3d p, r;
+            run(opts, "firi.maxVolInsEllipsoid", n, [&]()
+                { R.setIdentity();
+                  p.setZero();
+                  r.setConstant(0.1);
+                  firi::maxVolInsEllipsoid(hPoly, R, p, r);
+                  sink = r(0); },
+                results);
+        }
+
+        const Eigen::MatrixX4d bd = boxH(Eigen::Vector3d(-5.0, -5.0, -2.0),
+                                         Eigen::Vector3d(5.0, 5.0, 2.0));
+        const Eigen::Vector3d a(-1.0, 0.0, 0.0), bp(1.0, 0.0, 0.0);
+        std::uniform_real_distribution<double> uni(-1.0, 1.0);
+        for (const int n : {100, 1000, 10000})
+        {
+            // Obstacles are kept away from the seed segment
+            Eigen::Matrix3Xd pc(3, n);
+            for (int i = 0; i < n; i++)
+            {
+                Eigen::Vector3d p;
+                do
+                {
+                    p << 5.0 * uni(gen), 5.0 * uni(gen), 2.0 * uni(gen);
+                } while (std::fabs(p(0)) < 1.5 && p.tail<2>().norm() < 0.5);
+                pc.col(i) = p;
+            }
+            Eigen::MatrixX4d hPoly;
+            run(opts, "firi.firi", n, [&]()
+                { firi::firi(bd, pc, a, bp, hPoly);
+                  sink = hPoly.rows(); },
+                results);
+        }
+        return;
+    }
+
+    inline void benchRootFinder(const Options &opts, std::vector<Result> &results)
+    {
+        std::mt19937_64 gen(6);
+        std::uniform_real_distribution<double> uni(-1.0, 1.0);
+        for (const int deg : {3, 4, 6, 10})
+        {
+            Eigen::VectorXd coeffs(deg + 1);
+            for (int i = 0; i <= deg; i++)
+            {
+                coeffs(i) = uni(gen);
+            }
+            coeffs(0) = 1.0;
+            run(opts, "RootFinder.solvePolynomial", deg, [&]()
+                { sink = RootFinder::solvePolynomial(coeffs, -10.0, 10.0, 1.0e-6).size(); },
+                results);
+        }
+        return;
+    }
+
+    // Extended Rosenbrock function
+    inline double rosenbrock(void *,
+                             const Eigen::VectorXd &x,
+                             Eigen::VectorXd &g)
+    {
+        const int n = x.size();
+        double fx = 0.0;
+        for (int i = 0; i < n; i += 2)
+        {
+            const double t1 = 1.0 - x(i);
+            const double t2 = 10.0 * (x(i + 1) - x(i) * x(i));
+            g(i + 1) = 20.0 * t2;
+            g(i) = -2.0 * (x(i) * g(i + 1) + t1);
+            fx += t1 * t1 + t2 * t2;
+        }
+        return fx;
+    }
+
+    inline void benchLbfgs(const Options &opts, std::vector<Result> &results)
+    {
+        for (const int n : {10, 100, 1000})
+        {
+            lbfgs::lbfgs_parameter_t params;
+            params.mem_size = 16;
+            params.g_epsilon = 1.0e-8;
+            Eigen::VectorXd x(n);
+            run(opts, "lbfgs.rosenbrock", n, [&]()
+                { for (int i = 0; i < n; i += 2)
+                  {
+                      x(i) = -1.2;
+                      x(i + 1) = 1.0;
+                  }
+                  double fx;
+                  lbfgs::lbfgs_optimize(x, fx, &rosenbrock, nullptr, nullptr, nullptr, params);
+                  sink = fx; },
+                results);
+        }
+        return;
+    }
+
+    inline void benchVoxelMap(const Options &opts, std::vector<Result> &results)
+    {
+        std::mt19937_64 gen(8);
+        std::uniform_real_distribution<double> uni(0.0, 1.0);
+        const Eigen::Vector3d extent(40.0, 40.0, 10.0);
+        voxel_map::VoxelMap map(Eigen::Vector3i(400, 400, 100), Eigen::Vector3d::Zero(), 0.1, 2);
+        std::vector<Eigen::Vector3d> cloud(100000);
+        for (Eigen::Vector3d &p : cloud)
+        {
+            p = extent.cwiseProduct(Eigen::Vector3d(uni(gen), uni(gen), uni(gen)));
+        }
+        map.insert(cloud);
+
+        // Sizes are the number of operations per call
+        for (const int n : {1000, 100000})
+        {
+            std::vector<Eigen::Vector3d> qs(n);
+            for (Eigen::Vector3d &q : qs)
+            {
+                q = extent.cwiseProduct(Eigen::Vector3d(uni(gen), uni(gen), uni(gen)));
+            }
+            run(opts, "voxel_map.query", n, [&]()
+                { int blocked = 0;
+                  for (const Eigen::Vector3d &q : qs)
+                  {
+                      blocked += map.query(q);
+                  }
+                  sink = blocked; },
+                results);
+        }
+
+        for (const int n : {100, 1000})
+        {
+            std::vector<Eigen::Vector3d> ends(2 * n);
+            for (Eigen::Vector3d &q : ends)
+            {
+                q = extent.cwiseProduct(Eigen::Vector3d(uni(gen), uni(gen), uni(gen)));
+            }
+            run(opts, "voxel_map.raycast", n, [&]()
+                { int free = 0;
+                  for (int i = 0; i < n; i++)
+                  {
+                      free += map.raycast(ends[2 * i], ends[2 * i + 1]);
+                  }
+                  sink = free; },
+                results);
+        }
+
+        voxel_map::VoxelMap fresh(Eigen::Vector3i(400, 400, 100), Eigen::Vector3d::Zero(), 0.1, 2);
+        run(opts, "voxel_map.insert", cloud.size(), [&]()
+            { fresh.clear();
+              fresh.insert(cloud);
+              sink = fresh.query(cloud[0]); },
+            results);
+
+        std::vector<Eigen::Vector3d> surf;
+        run(opts, "voxel_map.getSurface", cloud.size(), [&]()
+            { map.getSurface(surf);
+              sink = surf.size(); },
+            results);
+        return;
+    }
+
+    inline void benchGridSearch(const Options &opts, std::vector<Result> &results)
+    {
+        std::mt19937_64 gen(9);
+        std::uniform_real_distribution<double> uni(0.0, 1.0);
+        voxel_map::VoxelMap map(Eigen::Vector3i(500, 500, 60), Eigen::Vector3d::Zero(), 0.1, 2);
+        for (int i = 0; i < 5000; i++)
+        {
+            map.insert(Eigen::Vector3d(50.0 * uni(gen), 50.0 * uni(gen), 6.0 * uni(gen)));
+        }
+
+        // Sizes are the distance between the endpoints in lattice steps
+        const double step = 0.2;
+        for (const int n : {20, 80, 200})
+        {
+            const Eigen::Vector3d s(2.0, 2.0, 3.0);
+            const Eigen::Vector3d g = s + Eigen::Vector3d(n * step / std::sqrt(2.0), n * step / std::sqrt(2.0), 0.0);
+            const Eigen::Vector3d lb(0.0, 0.0, 0.0), hb(50.0, 50.0, 6.0);
+            std::vector<Eigen::Vector3d> path;
+            run(opts, "grid_search.planPath", n, [&]()
+                { sink = grid_search::planPath(s, g, lb, hb, &map, step, path); },
+                results);
+        }
+        return;
+    }
+
+    inline void benchPointCloud(const Options &opts, std::vector<Result> &results)
+    {
+        std::mt19937_64 gen(10);
+        std::uniform_real_distribution<double> uni(0.0, 1.0);
+
+        // Sizes are the number of input points
+        for (const int n : {10000, 200000})
+        {
+            Eigen::Matrix3Xd cloud(3, n);
+            for (int i = 0; i < n; i++)
+            {
+                cloud.col(i) = Eigen::Vector3d(40.0 * uni(gen), 40.0 * uni(gen), 10.0 * uni(gen));
+            }
+            Eigen::Matrix3Xd out;
+            run(opts, "point_cloud.voxelDownsample", n, [&]()
+                { point_cloud::voxelDownsample(cloud, 0.2, out);
+                  sink = out.cols(); },
+                results);
+            run(opts, "point_cloud.removeOutliers", n, [&]()
+                { point_cloud::removeOutliers(cloud, 0.3, 2, out);
+                  sink = out.cols(); },
+                results);
+        }
+        return;
+    }
+
+    inline void benchSfcGen(const Options &opts, std::vector<Result> &results)
+    {
+        std::mt19937_64 gen(11);
+        std::uniform_real_distribution<double> uni(0.0, 1.0);
+        std::vector<Eigen::Vector3d> points;
+        for (int i = 0; i < 100000; i++)
+        {
+            const Eigen::Vector3d q(100.0 * uni(gen), 100.0 * uni(gen), 6.0 * uni(gen));
+            if (std::abs(q(0) - q(1)) > 2.0)
+            {
+                points.push_back(q);
+            }
+        }
+        const point_index::GridIndex index(points);
+        const Eigen::Vector3d lb(0.0, 0.0, 0.0), hb(100.0, 100.0, 6.0);
+
+        // Sizes are the number of path segments to cover
+        for (const int n : {5, 20})
+        {
+            const double progress = 5.0;
+            const Eigen::Vector3d s(1.0, 1.0, 3.0);
+            const Eigen::Vector3d g = s + Eigen::Vector3d(1.0, 1.0, 0.0) * (n * progress / std::sqrt(2.0));
+            const std::vector<Eigen::Vector3d> path = {s, g};
+            std::vector<Eigen::MatrixX4d> hpolys, cut;
+            run(opts, "sfc_gen.convexCover", n, [&]()
+                { sfc_gen::convexCover(path, index, lb, hb, progress, 2.0, hpolys);
+                  sink = hpolys.size(); },
+                results);
+            run(opts, "sfc_gen.shortCut", n, [&]()
+                { cut = hpolys;
+                  sfc_gen::shortCut(cut);
+                  sink = cut.size(); },
+                results);
+        }
+        return;
+    }
+
+    // Prints a failed check, returns 1 if it failed
+    inline int expect(const bool ok, const char *what)
+    {
+        if (!ok)
+        {
+            std::fprintf(stderr, "CHECK FAILED: %s\n", what);
+        }
+        return ok ? 0 : 1;
+    }
+
+    inline int checkPointCloud()
+    {
+        int failed = 0;
+        // The origin of the cells of this cloud used to round to just
+        // above its minimum, which put the first point out of the grid
+        Eigen::Matrix3Xd cloud(3, 2), out;
+        cloud << 14.56, 14.561,
+            1.0, 1.001,
+            1.0, 1.001;
+        failed += expect(point_cloud::voxelDownsample(cloud, 0.07, out) && out.cols() == 1,
+                         "point_cloud.voxelDownsample merges two points of one voxel at a rounded origin");
+        failed += expect(point_cloud::removeOutliers(cloud, 0.07, 1, out) && out.cols() == 2,
+                         "point_cloud.removeOutliers keeps two close points at a rounded origin");
+        return failed;
+    }
+
+    // The blocked test against a point by point one, for point counts
+    // that do and do not fill the last block of eight
+    inline int checkAnyInside()
+    {
+        std::mt19937_64 gen(14);
+        std::uniform_real_distribution<double> uni(-1.0, 1.0);
+        Eigen::MatrixX4d hPoly(20, 4);
+        for (int i = 0; i < hPoly.rows(); i++)
+        {
+            const Eigen::Vector3d n = Eigen::Vector3d(uni(gen), uni(gen), uni(gen)).normalized();
+            hPoly.row(i) << n.transpose(), -1.0;
+        }
+        bool same = true;
+        unsigned long long allocs = 0;
+        for (int n = 0; n <= 40; n++)
+        {
+            Eigen::Matrix3Xd pc(3, n);
+            for (int i = 0; i < n; i++)
+            {
+                // Mostly outside, so that the test rarely stops early
+                pc.col(i) = Eigen::Vector3d(uni(gen), uni(gen), uni(gen)).normalized() * (1.0 + 3.0 * std::abs(uni(gen)));
+            }
+            if (n > 0 && n % 3 == 0)
+            {
+                pc.col(n - 1) *= 0.1;
+            }
+            bool inside = false;
+            for (int i = 0; i < n; i++)
+            {
+                inside = inside || (hPoly.leftCols<3>() * pc.col(i) + hPoly.col(3)).maxCoeff() < -1.0e-6;
+            }
+            const unsigned long long start = allocCount.load();
+            same = same && firi::anyInside(hPoly, pc, 1.0e-6) == inside;
+            allocs += allocCount.load() - start;
+        }
+        return expect(same && allocs == 0,
+                      "firi.anyInside matches the point by point test without allocating");
+    }
+
+    // Endpoints off the lattice, joined to it by segments no move checks
+    inline int checkGridSearch()
+    {
+        voxel_map::VoxelMap map(Eigen::Vector3i(100, 50, 10), Eigen::Vector3d::Zero(), 0.1);
+        const auto segmentFree = [&](const Eigen::Vector3d &a, const Eigen::Vector3d &b)
+        {
+            for (int i = 0; i <= 1000; i++)
+            {
+                if (map.query(a + (b - a) * (i / 1000.0)) != 0)
+                {
+                    return false;
+                }
+            }
+            return true;
+        };
+        const Eigen::Vector3d lb(0.0, 0.0, 0.55), hb(10.0, 5.0, 0.55);
+        // s is nearest to the lattice node (1.0, 1.2), and the straight
+        // line from it to g passes a voxel the lattice row does not
+        const Eigen::Vector3d s(1.0, 1.35, 0.55), g(5.0, 1.2, 0.55);
+        map.insert(Eigen::Vector3d(1.55, 1.33, 0.55));
+        std::vector<Eigen::Vector3d> path;
+        const double length = grid_search::planPath(s, g, lb, hb, &map, 0.4, path);
+        bool free = std::isfinite(length) && path.size() >= 2 &&
+                    path.front() == s && path.back() == g;
+        for (size_t i = 1; free && i < path.size(); i++)
+        {
+            free = segmentFree(path[i - 1], path[i]);
+        }
+        int failed = expect(free, "grid_search.planPath joins off-lattice endpoints by free segments");
+
+        // A blocked start next to a free lattice node has no path
+        map.insert(s);
+        path.clear();
+        failed += expect(std::isinf(grid_search::planPath(s, g, lb, hb, &map, 0.4, path)) && path.empty(),
+                         "grid_search.planPath rejects a blocked start next to a free lattice node");
+        return failed;
+    }
+
+    inline int checkSfcGen()
+    {
+        std::mt19937_64 gen(12);
+        std::uniform_real_distribution<double> uni(0.0, 1.0);
+        std::vector<Eigen::Vector3d> points;
+        for (int i = 0; i < 20000; i++)
+        {
+            const Eigen::Vector3d q(30.0 * uni(gen), 30.0 * uni(gen), 6.0 * uni(gen));
+            if (std::abs(q(0) - q(1)) > 1.0)
+            {
+                points.push_back(q);
+            }
+        }
+        const point_index::GridIndex index(points);
+        const Eigen::Vector3d lb(0.0, 0.0, 0.0), hb(30.0, 30.0, 6.0);
+        const std::vector<Eigen::Vector3d> path = {Eigen::Vector3d(1.0, 1.0, 3.0),
+                                                   Eigen::Vector3d(15.0, 15.5, 3.0),
+                                                   Eigen::Vector3d(29.0, 29.0, 3.0)};
+        std::vector<Eigen::MatrixX4d> seq, par;
+        sfc_gen::convexCover(path, index, lb, hb, 3.0, 2.0, seq);
+        thread_pool::ThreadPool pool(3);
+        sfc_gen::convexCover(path, index, lb, hb, 3.0, 2.0, pool, par);
+        bool same = seq.size() == par.size();
+        for (size_t i = 0; same && i < seq.size(); i++)
+        {
+            same = seq[i].rows() == par[i].rows() && seq[i] == par[i];
+        }
+        int failed = expect(same, "sfc_gen.convexCover gives the same corridor sequentially and on a pool");
+
+        // Non-finite points are left out of the index and change no query
+        std::vector<Eigen::Vector3d> dirty = points;
+        dirty.insert(dirty.begin() + 7, Eigen::Vector3d(NAN, 1.0, 1.0));
+        dirty.insert(dirty.begin() + 300, Eigen::Vector3d(1.0, INFINITY, 1.0));
+        dirty.push_back(Eigen::Vector3d(-INFINITY, 1.0, NAN));
+        const point_index::GridIndex dirtyIndex(dirty);
+        same = dirtyIndex.size() == index.size();
+        for (int i = 0; same && i < 100; i++)
+        {
+            const Eigen::Vector3d lo(30.0 * uni(gen), 30.0 * uni(gen), 6.0 * uni(gen));
+            const Eigen::Vector3d hi = lo + Eigen::Vector3d::Constant(3.0);
+            std::vector<Eigen::Vector3d> a, b;
+            index.query(lo, hi, a);
+            dirtyIndex.query(lo, hi, b);
+            same = a == b;
+        }
+        std::vector<Eigen::Vector3d> none;
+        dirtyIndex.query(Eigen::Vector3d(NAN, 0.0, 0.0), hb, none);
+        failed += expect(same && none.empty(),
+                         "point_index.GridIndex skips non-finite points and boxes");
+        return failed;
+    }
+
+    // The swarm penalty gradients against central differences, with a
+    // neighbour that crosses the path so that part of the samples violate
+    inline int checkSwarmGradient()
+    {
+        std::mt19937_64 gen(13);
+        const int n = 8;
+        Eigen::Matrix3d head, tail;
+        Eigen::Matrix3Xd inPs;
+        Eigen::VectorXd ts;
+        wavyPath(n, gen, head, tail, inPs, ts);
+        ts.array() += 0.0371;
+        minco::MINCO_S2NU minco;
+        minco.setConditions(head, tail, n);
+
+        std::vector<Trajectory<3>> otherAgents(1);
+        Eigen::Matrix3Xd otherPs = inPs.rowwise().reverse();
+        otherPs.row(2).array() += 0.3;
+        minco.setParameters(otherPs, ts);
+        minco.getTrajectory(otherAgents[0]);
+
+        gcopter::GCOPTER_PolytopeSFC::PolyhedraH hPolys;
+        const Eigen::VectorXi hIdx = Eigen::VectorXi::Zero(n);
+        Eigen::Matrix3d E = Eigen::Matrix3d::Identity();
+        E(2, 2) = 2.0;
+        const auto swarmCost = [&](const Eigen::VectorXd &T,
+                                   const Eigen::MatrixX3d &C,
+                                   Eigen::VectorXd &gradT,
+                                   Eigen::MatrixX3d &gradC)
+        {
+            double cost = 0.0;
+            gradT.setZero(n);
+            gradC.setZero(4 * n, 3);
+            gcopter::detail::attachSwarmPenaltyFunctional(T, C, hIdx, hPolys, 1.0e-2, 16,
+                                                          1.0, E, otherAgents,
+                                                          cost, gradT, gradC);
+            return cost;
+        };
+
+        minco.setParameters(inPs, ts);
+        const Eigen::MatrixX3d coeffs = minco.getCoeffs();
+        Eigen::VectorXd gradT, gT;
+        Eigen::MatrixX3d gradC, gC;
+        const double cost = swarmCost(ts, coeffs, gradT, gradC);
+
+        const double h = 1.0e-6;
+        double err = 0.0, scale = 0.0;
+        for (int i = 0; i < n; i++)
+        {
+            Eigen::VectorXd tp = ts, tm = ts;
+            tp(i) += h;
+            tm(i) -= h;
+            const double fd = (swarmCost(tp, coeffs, gT, gC) - swarmCost(tm, coeffs, gT, gC)) / (2.0 * h);
+            err = std::max(err, std::abs(fd - gradT(i)));
+            scale = std::max(scale, std::abs(gradT(i)));
+        }
+        for (int i = 0; i < coeffs.size(); i++)
+        {
+            Eigen::MatrixX3d cp = coeffs, cm = coeffs;
+            cp(i) += h;
+            cm(i) -= h;
+            const double fd = (swarmCost(ts, cp, gT, gC) - swarmCost(ts, cm, gT, gC)) / (2.0 * h);
+            err = std::max(err, std::abs(fd - gradC(i)));
+            scale = std::max(scale, std::abs(gradC(i)));
+        }
+        return expect(cost > 0.0 && err < 1.0e-5 * scale,
+                      "gcopter swarm penalty gradients match central differences");
+    }
+
+    // A corridor of boxes, planned through the interior LP and QuickHull
+    // and through the closed-form box path, around a neighbour that
+    // crosses it
+    inline int checkBoxCorridor()
+    {
+        Eigen::VectorXd magnitudeBounds(5), penaltyWeights(5), physicalParams(6);
+        magnitudeBounds << 4.0, 10.0, 1.05, 2.0, 12.0;
+        penaltyWeights << 1.0e3, 1.0e3, 1.0e3, 1.0e3, 1.0e4;
+        physicalParams << 0.61, 9.8, 0.70, 0.80, 0.01, 0.0001;
+
+        const int n = 8;
+        gcopter::GCOPTER_PolytopeSFC::PolyhedraH hPolys;
+        for (int i = 0; i < n; i++)
+        {
+            const double y = std::sin(0.5 * i);
+            hPolys.push_back(boxH(Eigen::Vector3d(i - 0.5, y - 1.0, -0.5),
+                                  Eigen::Vector3d(i + 1.5, y + 1.0, 0.5)));
+        }
+        Eigen::Matrix3d head, tail;
+        head.setZero();
+        tail.setZero();
+        tail.col(0) << n, std::sin(0.5 * (n - 1)), 0.0;
+
+        std::vector<double> durations = {8.0};
+        std::vector<Eigen::Matrix<double, 3, 4>> coeffMats(1);
+        coeffMats[0].setZero();
+        coeffMats[0].col(3) << 0.5 * n, std::sin(0.25 * n), 0.8;
+        std::vector<Trajectory<3>> otherAgents(1);
+        otherAgents[0] = Trajectory<3>(durations, coeffMats);
+
+        int failed = 0;
+        for (const bool swarm : {false, true})
+        {
+            double costs[2];
+            for (const bool box : {false, true})
+            {
+                gcopter::GCOPTER_PolytopeSFC planner;
+                planner.setBoxCorridor(box);
+                Trajectory<3> traj;
+                costs[box] = INFINITY;
+                if (planner.setup(20.0, head, tail, hPolys, 1.0, 1.0e-2, 16,
+                                  magnitudeBounds, penaltyWeights, physicalParams))
+                {
+                    if (swarm)
+                    {
+                        planner.setSwarmObstacleParams(otherAgents, 1.2, Eigen::Matrix3d::Identity());
+                    }
+                    costs[box] = planner.optimize(traj, 1.0e-8);
+                }
+            }
+            failed += expect(std::isfinite(costs[0]) &&
+                                 std::abs(costs[1] - costs[0]) <= 1.0e-5 * costs[0],
+                             swarm ? "gcopter box corridor costs the same with and without setBoxCorridor, with a neighbour"
+                                   : "gcopter box corridor costs the same with and without setBoxCorridor");
+        }
+        return failed;
+    }
+
+    // A warm planner and a fresh one get the same corridor without its
+    // first box, so the cache holds every polytope at another slot
+    inline int checkVertexCache()
+    {
+        Eigen::VectorXd magnitudeBounds(5), penaltyWeights(5), physicalParams(6);
+        magnitudeBounds << 4.0, 10.0, 1.05, 2.0, 12.0;
+        penaltyWeights << 1.0e3, 1.0e3, 1.0e3, 1.0e3, 1.0e4;
+        physicalParams << 0.61, 9.8, 0.70, 0.80, 0.01, 0.0001;
+
+        const int n = 8;
+        gcopter::GCOPTER_PolytopeSFC::PolyhedraH hPolys;
+        for (int i = 0; i < n; i++)
+        {
+            const double y = std::sin(0.5 * i);
+            hPolys.push_back(boxH(Eigen::Vector3d(i - 0.5, y - 1.0, -0.5),
+                                  Eigen::Vector3d(i + 1.5, y + 1.0, 0.5)));
+        }
+        Eigen::Matrix3d head, tail;
+        head.setZero();
+        tail.setZero();
+        tail.col(0) << n, std::sin(0.5 * (n - 1)), 0.0;
+
+        const auto plan = [&](gcopter::GCOPTER_PolytopeSFC &planner,
+                              const gcopter::GCOPTER_PolytopeSFC::PolyhedraH &corridor,
+                              const Eigen::Matrix3d &start)
+        {
+            Trajectory<3> traj;
+            if (!planner.setup(20.0, start, tail, corridor, 1.0, 1.0e-2, 16,
+                               magnitudeBounds, penaltyWeights, physicalParams))
+            {
+                return (double)NAN;
+            }
+            return planner.optimize(traj, 1.0e-8);
+        };
+
+        gcopter::GCOPTER_PolytopeSFC warm, fresh;
+        plan(warm, hPolys, head);
+        const gcopter::GCOPTER_PolytopeSFC::PolyhedraH shifted(hPolys.begin() + 1, hPolys.end());
+        Eigen::Matrix3d start = head;
+        start(0, 0) = 1.0;
+        start(1, 0) = std::sin(0.5);
+        start(0, 1) = 1.0;
+        const double warmCost = plan(warm, shifted, start);
+        const double freshCost = plan(fresh, shifted, start);
+        int failed = expect(std::isfinite(freshCost) && warmCost == freshCost,
+                            "gcopter gives the same result with a warm vertex cache");
+
+        // The same corridor again is served from the cache alone
+        plan(warm, shifted, start);
+        failed += expect(warm.getStats().vertexCacheMisses == 0 &&
+                             warm.getStats().vertexCacheHits == 2 * (n - 1) - 1,
+                         "gcopter serves a repeated corridor from the vertex cache");
+        return failed;
+    }
+
+    inline int runChecks()
+    {
+        int failed = 0;
+        failed += checkPointCloud();
+        failed += checkAnyInside();
+        failed += checkGridSearch();
+        failed += checkSfcGen();
+        failed += checkSwarmGradient();
+        failed += checkBoxCorridor();
+        failed += checkVertexCache();
+        std::fprintf(stderr, "%d check(s) failed\n", failed);
+        return failed;
+    }
+
+    inline void writeJson(std::FILE *fp, const std::vector<Result> &results)
+    {
+        std::fprintf(fp, "{\n  \"benchmarks\": [\n");
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const Result &r = results[i];
+            std::fprintf(fp,
+                         "    {\"name\": \"%s\", \"size\": %d, \"samples\": %d, "
+                         "\"median_us\": %.4f, \"p99_us\": %.4f, \"mean_us\": %.4f, "
+                         "\"allocs_per_call\": %.2f}%s\n",
+                         r.name.c_str(), r.size, r.samples,
+                         r.median, r.p99, r.mean, r.allocs,
+                         i + 1 < results.size() ? "," : "");
+        }
+        std::fprintf(fp, "  ]\n}\n");
+        return;
+    }
+
+}
+
+int main(int argc, char **argv)
+{
+    bench::Options opts;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+        {
+            opts.filter = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+        {
+            opts.minTime = std::atof(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+        {
+            opts.out = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--check") == 0)
+        {
+            return bench::runChecks();
+        }
+        else
+        {
+            std::fprintf(stderr, "Usage: %s [--filter <substring>] [--min-time <seconds>] [--out <file.json>]\n"
+                                 "       %s --check\n",
+                         argv[0], argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<bench::Result> results;
+    bench::benchMinco(opts, results);
+    bench::benchPenalty(opts, results);
+    bench::benchSetup(opts, results);
+    bench::benchFlatness(opts, results);
+    bench::benchGeometry(opts, results);
+    bench::benchRootFinder(opts, results);
+    bench::benchLbfgs(opts, results);
+    bench::benchVoxelMap(opts, results);
+    bench::benchGridSearch(opts, results);
+    bench::benchPointCloud(opts, results);
+    bench::benchSfcGen(opts, results);
+
+    std::FILE *fp = opts.out.empty() ? stdout : std::fopen(opts.out.c_str(), "w");
+    if (fp == nullptr)
+    {
+        std::fprintf(stderr, "Cannot open %s\n", opts.out.c_str());
+        return 1;
+    }
+    bench::writeJson(fp, results);
+    if (fp != stdout)
+    {
+        std::fclose(fp);
+    }
+
+    return 0;
+}
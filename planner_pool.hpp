@@ -0,0 +1,200 @@
+#ifndef PLANNER_POOL_HPP
+#define PLANNER_POOL_HPP
+
+#include "gcopter.hpp"
+#include "corridor_cache.hpp"
+#include "thread_pool.hpp"
+
+#include <Eigen/Eigen>
+
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <future>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace planner_pool
+{
+
+    // Everything GCOPTER_PolytopeSFC::setup, setSwarmObstacleParams
+    // and optimize need for one planning problem
+    struct PlanRequest
+    {
+        double timeWeight = 5.0;
+        Eigen::Matrix3d headPVA = Eigen::Matrix3d::Zero();
+        Eigen::Matrix3d tailPVA = Eigen::Matrix3d::Zero();
+        gcopter::GCOPTER_PolytopeSFC::PolyhedraH corridor;
+        double lengthPerPiece = 0.5;
+        double smoothingFactor = 0.2;
+        int integralResolution = 6;
+        Eigen::VectorXd magnitudeBounds;
+        Eigen::VectorXd penaltyWeights;
+        Eigen::VectorXd physicalParams;
+        double relCostTol = 1.0e-4;
+        // Optimization deadline counted from the start of optimize, <= 0 for none
+        double timeBudget = 0.0;
+        // Iteration at which the solve stops as if canceled, < 0 for none
+        int stopIteration = -1;
+        // Solve with optimizeAnytime instead, which takes its budget and
+        // tolerance from anytimeParams. The slacks and check resolution of
+        // anytimeParams also decide PlanResult::feasible in both modes.
+        bool anytime = false;
+        gcopter::AnytimeParams anytimeParams;
+        uint64_t randSeed = std::mt19937_64::default_seed;
+        // See GCOPTER_PolytopeSFC::setBoxCorridor and setVertexCacheCapacity
+        bool boxCorridor = false;
+        size_t vertexCacheCapacity = corridor_cache::defaultCapacity;
+
+        // Neighbour trajectories, left empty to disable the swarm penalty
+        std::vector<Trajectory<3>> otherAgents;
+        double swarmThreshold = 1.0;
+        Eigen::Matrix3d swarmEllipsoid = Eigen::Matrix3d::Identity();
+    };
+
+    struct PlanResult
+    {
+        // The solve converged to a trajectory that passes isFeasible
+        bool success = false;
+        bool feasible = false;
+        int status = gcopter::OPTIMIZE_FAILED;
+        double cost = INFINITY;
+        Trajectory<3> traj;
+        // Seconds spent waiting in the queue and inside setup + optimize
+        double queueLatency = 0.0;
+        double solveLatency = 0.0;
+        int worker = -1;
+        gcopter::PlannerStats stats;
+    };
+
+    // Dispatches planning requests to a work-stealing thread pool.
+    // Each worker owns a planner instance that is reused across
+    // requests, so its buffers are only reallocated on growth.
+    class PlannerPool
+    {
+    public:
+        typedef std::function<void(PlanResult &&)> Callback;
+
+        explicit PlannerPool(int threadNum = 0)
+            : pool(threadNum)
+        {
+            planners.reserve(pool.size());
+            for (int i = 0; i < pool.size(); i++)
+            {
+                planners.emplace_back(new gcopter::GCOPTER_PolytopeSFC());
+            }
+        }
+
+        inline int size() const
+        {
+            return pool.size();
+        }
+
+        inline std::future<PlanResult> submit(PlanRequest request)
+        {
+            const auto req = std::make_shared<PlanRequest>(std::move(request));
+            const auto queued = std::chrono::steady_clock::now();
+            return pool.submit([this, req, queued]()
+                               { return solve(*req, queued); });
+        }
+
+        inline void submit(PlanRequest request, Callback callback)
+        {
+            const auto req = std::make_shared<PlanRequest>(std::move(request));
+            const auto queued = std::chrono::steady_clock::now();
+            pool.post([this, req, queued, callback]()
+                      { callback(solve(*req, queued)); });
+            return;
+        }
+
+        inline void planAll(const std::vector<PlanRequest> &requests,
+                            std::vector<PlanResult> &results)
+        {
+            std::vector<std::future<PlanResult>> futures;
+            futures.reserve(requests.size());
+            for (const PlanRequest &req : requests)
+            {
+                futures.push_back(submit(req));
+            }
+            results.clear();
+            results.reserve(requests.size());
+            for (auto &f : futures)
+            {
+                results.push_back(f.get());
+            }
+            return;
+        }
+
+    private:
+        // Declared before the pool so that workers are joined first
+        std::vector<std::unique_ptr<gcopter::GCOPTER_PolytopeSFC>> planners;
+        thread_pool::ThreadPool pool;
+
+        inline PlanResult solve(const PlanRequest &req,
+                                const std::chrono::steady_clock::time_point &queued)
+        {
+            const auto start = std::chrono::steady_clock::now();
+
+            PlanResult result;
+            result.worker = pool.workerIndex();
+            gcopter::GCOPTER_PolytopeSFC &planner = *planners[result.worker];
+
+            planner.setRandomSeed(req.randSeed);
+            planner.setBoxCorridor(req.boxCorridor);
+            planner.setVertexCacheCapacity(req.vertexCacheCapacity);
+            planner.setSwarmObstacleParams(req.otherAgents,
+                                           req.swarmThreshold,
+                                           req.swarmEllipsoid);
+            if (planner.setup(req.timeWeight,
+                              req.headPVA,
+                              req.tailPVA,
+                              req.corridor,
+                              req.lengthPerPiece,
+                              req.smoothingFactor,
+                              req.integralResolution,
+                              req.magnitudeBounds,
+                              req.penaltyWeights,
+                              req.physicalParams))
+            {
+                if (req.anytime)
+                {
+                    gcopter::AnytimeReport report;
+                    result.cost = planner.optimizeAnytime(result.traj, req.anytimeParams, report);
+                }
+                else
+                {
+                    gcopter::OptimizeControl ctrl;
+                    if (req.timeBudget > 0.0)
+                    {
+                        // Setup does not count, as in a recorded budget
+                        ctrl.deadline = std::chrono::steady_clock::now() +
+                                        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                            std::chrono::duration<double>(req.timeBudget));
+                    }
+                    if (req.stopIteration >= 0)
+                    {
+                        const int stop = req.stopIteration;
+                        ctrl.observer = [stop](const gcopter::IterationInfo &info)
+                        { return info.iteration < stop; };
+                    }
+                    result.cost = planner.optimize(result.traj, req.relCostTol, ctrl);
+                }
+                result.status = planner.getStatus();
+                result.feasible = std::isfinite(result.cost) &&
+                                  planner.isFeasible(result.traj, req.anytimeParams);
+                result.success = result.status == gcopter::OPTIMIZE_SUCCESS &&
+                                 result.feasible;
+            }
+            result.stats = planner.getStats();
+
+            const auto end = std::chrono::steady_clock::now();
+            result.queueLatency = std::chrono::duration<double>(start - queued).count();
+            result.solveLatency = std::chrono::duration<double>(end - start).count();
+            return result;
+        }
+    };
+
+}
+
+#endif
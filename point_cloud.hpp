@@ -0,0 +1,599 @@
+#ifndef POINT_CLOUD_HPP
+#define POINT_CLOUD_HPP
+
+#include "thread_pool.hpp"
+
+#include <Eigen/Eigen>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Preprocessing of obstacle clouds before corridor generation: cropping,
+// voxel downsampling and radius outlier removal, all on packed 3xN
+// buffers. Every stage runs on an optional thread pool and its output
+// does not depend on the number of threads. Points are assumed finite
+// except by crop, which drops those with a NaN coordinate.
+namespace point_cloud
+{
+
+    // Binary layout, all values in host byte order:
+    //   "GPCL", uint32 version, uint64 point count, then the points as
+    //   col-major 3xN doubles, so that a mapped file is a Matrix3Xd as is.
+    constexpr char magic[4] = {'G', 'P', 'C', 'L'};
+    constexpr uint32_t version = 1;
+    constexpr size_t headerBytes = 16;
+
+    namespace internal
+    {
+        constexpr int minChunk = 4096;
+
+        inline int chunkNum(const int64_t n, thread_pool::ThreadPool *pool)
+        {
+            if (pool == nullptr)
+            {
+                return 1;
+            }
+            return (int)std::max<int64_t>(1, std::min<int64_t>(n / minChunk, 4 * (pool->size() + 1)));
+        }
+
+        // Calls func(c, begin, end) for each of the chunks of [0, n)
+        template <typename F>
+        inline void forChunks(const int64_t n, const int chunks,
+                              thread_pool::ThreadPool *pool, const F &func)
+        {
+            const auto body = [&](const int c)
+            { func(c, n * c / chunks, n * (c + 1) / chunks); };
+            if (pool == nullptr || chunks == 1)
+            {
+                for (int c = 0; c < chunks; c++)
+                {
+                    body(c);
+                }
+            }
+            else
+            {
+                pool->parallelFor(chunks, body);
+            }
+            return;
+        }
+
+        // Point index tagged with the key of its cell
+        struct CellKey
+        {
+            uint64_t key;
+            int64_t index;
+        };
+
+        // Cells of a given size from the minimum corner of a cloud. Keys
+        // pack the cell coordinates z, y, x from high to low bits, each
+        // with room for one cell past the cloud, so that keys of a row of
+        // cells along x are consecutive.
+        struct CellGrid
+        {
+            // Index of the cell of the minimum corner on the global lattice
+            Eigen::Vector3d base;
+            double cell;
+            int bits[3];
+
+            inline uint64_t key(const int64_t x, const int64_t y, const int64_t z) const
+            {
+                return (uint64_t)x | ((uint64_t)y << bits[0]) | ((uint64_t)z << (bits[0] + bits[1]));
+            }
+
+            inline int64_t coord(const uint64_t key, const int axis) const
+            {
+                const int shift = axis == 0 ? 0 : (axis == 1 ? bits[0] : bits[0] + bits[1]);
+                return (key >> shift) & ((uint64_t(1) << bits[axis]) - 1);
+            }
+
+            // Cell coordinate of a value along an axis. It is computed the
+            // same way as base, so that the minimum lands on 0 whatever the
+            // rounding, and kept within the field of the axis so that it
+            // cannot spill into the others.
+            inline int64_t clamped(const double v, const int axis) const
+            {
+                const double c = std::floor(v / cell) - base(axis);
+                return (int64_t)std::max(0.0, std::min(c, std::ldexp(1.0, bits[axis]) - 1.0));
+            }
+
+            inline int totalBits() const
+            {
+                return bits[0] + bits[1] + bits[2];
+            }
+        };
+
+        // LSD radix sort by key. Each pass is stable, so entries of equal
+        // key keep their order, and passes whose digit is the same for all
+        // entries are skipped. Chunks histogram and scatter in parallel.
+        inline void radixSort(std::vector<CellKey> &keys,
+                              const int keyBits,
+                              thread_pool::ThreadPool *pool)
+        {
+            constexpr int digitBits = 11;
+            constexpr int buckets = 1 << digitBits;
+            const int64_t n = keys.size();
+            const int chunks = chunkNum(n, pool);
+            std::vector<CellKey> tmp(n);
+            std::vector<int64_t> hist((size_t)chunks * buckets);
+            for (int shift = 0; shift < keyBits; shift += digitBits)
+            {
+                std::fill(hist.begin(), hist.end(), 0);
+                forChunks(n, chunks, pool, [&](const int c, const int64_t begin, const int64_t end)
+                          {
+                              int64_t *h = &hist[(size_t)c * buckets];
+                              for (int64_t i = begin; i < end; i++)
+                              {
+                                  h[(keys[i].key >> shift) & (buckets - 1)]++;
+                              } });
+
+                // Offsets bucket by bucket, and chunk by chunk within one
+                int64_t sum = 0;
+                bool single = false;
+                for (int d = 0; d < buckets; d++)
+                {
+                    int64_t total = 0;
+                    for (int c = 0; c < chunks; c++)
+                    {
+                        const int64_t count = hist[(size_t)c * buckets + d];
+                        hist[(size_t)c * buckets + d] = sum;
+                        sum += count;
+                        total += count;
+                    }
+                    single = single || total == n;
+                }
+                if (single)
+                {
+                    continue;
+                }
+
+                forChunks(n, chunks, pool, [&](const int c, const int64_t begin, const int64_t end)
+                          {
+                              int64_t *h = &hist[(size_t)c * buckets];
+                              for (int64_t i = begin; i < end; i++)
+                              {
+                                  tmp[h[(keys[i].key >> shift) & (buckets - 1)]++] = keys[i];
+                              } });
+                keys.swap(tmp);
+            }
+            return;
+        }
+
+        // Cell keys of all points sorted by key then index. False if the
+        // cloud spans too many cells for a 64-bit key.
+        inline bool sortedCells(const Eigen::Ref<const Eigen::Matrix3Xd> &points,
+                                const double cell,
+                                thread_pool::ThreadPool *pool,
+                                CellGrid &grid,
+                                std::vector<CellKey> &keys)
+        {
+            const int64_t n = points.cols();
+            const int chunks = chunkNum(n, pool);
+            std::vector<Eigen::Vector3d> los(chunks), his(chunks);
+            forChunks(n, chunks, pool, [&](const int c, const int64_t begin, const int64_t end)
+                      {
+                          Eigen::Vector3d lo = Eigen::Vector3d::Constant(INFINITY);
+                          Eigen::Vector3d hi = -lo;
+                          for (int64_t i = begin; i < end; i++)
+                          {
+                              lo = lo.cwiseMin(points.col(i));
+                              hi = hi.cwiseMax(points.col(i));
+                          }
+                          los[c] = lo;
+                          his[c] = hi; });
+            Eigen::Vector3d lo = Eigen::Vector3d::Zero();
+            Eigen::Vector3d hi = Eigen::Vector3d::Zero();
+            if (n > 0)
+            {
+                lo = los[0];
+                hi = his[0];
+            }
+            for (int c = 1; c < chunks; c++)
+            {
+                lo = lo.cwiseMin(los[c]);
+                hi = hi.cwiseMax(his[c]);
+            }
+
+            grid.base = (lo / cell).array().floor();
+            grid.cell = cell;
+            for (int a = 0; a < 3; a++)
+            {
+                const double cells = std::floor(hi(a) / cell) - grid.base(a) + 2.0;
+                grid.bits[a] = 1;
+                while (grid.bits[a] < 63 && std::ldexp(1.0, grid.bits[a]) < cells)
+                {
+                    grid.bits[a]++;
+                }
+            }
+            if (!(grid.totalBits() <= 63))
+            {
+                printf("POINT CLOUD WARNING: cell size %g is too small for the cloud extent\n", cell);
+                return false;
+            }
+
+            keys.resize(n);
+            forChunks(n, chunks, pool, [&](const int, const int64_t begin, const int64_t end)
+                      {
+                          for (int64_t i = begin; i < end; i++)
+                          {
+                              keys[i].key = grid.key(grid.clamped(points(0, i), 0),
+                                                     grid.clamped(points(1, i), 1),
+                                                     grid.clamped(points(2, i), 2));
+                              keys[i].index = i;
+                          } });
+            radixSort(keys, grid.totalBits(), pool);
+            return true;
+        }
+
+        // First entry of every cell, closed by keys.size()
+        inline void cellStarts(const std::vector<CellKey> &keys,
+                               std::vector<int64_t> &starts)
+        {
+            starts.clear();
+            for (size_t i = 0; i < keys.size(); i++)
+            {
+                if (i == 0 || keys[i].key != keys[i - 1].key)
+                {
+                    starts.push_back(i);
+                }
+            }
+            starts.push_back(keys.size());
+            return;
+        }
+    }
+
+    // Points p with lo <= p <= hi in every coordinate, in their order
+    inline void crop(const Eigen::Ref<const Eigen::Matrix3Xd> &points,
+                     const Eigen::Vector3d &lo,
+                     const Eigen::Vector3d &hi,
+                     Eigen::Matrix3Xd &out,
+                     thread_pool::ThreadPool *pool = nullptr)
+    {
+        const int64_t n = points.cols();
+        const int chunks = internal::chunkNum(n, pool);
+        std::vector<int64_t> offsets(chunks + 1, 0);
+        const auto inside = [&](const int64_t i)
+        {
+            return (points.col(i).array() >= lo.array()).all() &&
+                   (points.col(i).array() <= hi.array()).all();
+        };
+        internal::forChunks(n, chunks, pool, [&](const int c, const int64_t begin, const int64_t end)
+                            {
+                                int64_t count = 0;
+                                for (int64_t i = begin; i < end; i++)
+                                {
+                                    count += inside(i);
+                                }
+                                offsets[c + 1] = count; });
+        for (int c = 0; c < chunks; c++)
+        {
+            offsets[c + 1] += offsets[c];
+        }
+        out.resize(3, offsets[chunks]);
+        internal::forChunks(n, chunks, pool, [&](const int c, const int64_t begin, const int64_t end)
+                            {
+                                int64_t k = offsets[c];
+                                for (int64_t i = begin; i < end; i++)
+                                {
+                                    if (inside(i))
+                                    {
+                                        out.col(k++) = points.col(i);
+                                    }
+                                } });
+        return;
+    }
+
+    // Centroid of the points in each occupied cube of the given edge,
+    // ordered by cell. False if the cloud is too wide for the leaf size.
+    inline bool voxelDownsample(const Eigen::Ref<const Eigen::Matrix3Xd> &points,
+                                const double leafSize,
+                                Eigen::Matrix3Xd &out,
+                                thread_pool::ThreadPool *pool = nullptr)
+    {
+        internal::CellGrid grid;
+        std::vector<internal::CellKey> keys;
+        if (!internal::sortedCells(points, leafSize, pool, grid, keys))
+        {
+            return false;
+        }
+
+        std::vector<int64_t> starts;
+        internal::cellStarts(keys, starts);
+        const int64_t cells = starts.size() - 1;
+
+        // Points of a cell are summed in their original order
+        out.resize(3, cells);
+        internal::forChunks(cells, internal::chunkNum(cells, pool), pool,
+                            [&](const int, const int64_t begin, const int64_t end)
+                            {
+                                for (int64_t k = begin; k < end; k++)
+                                {
+                                    Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+                                    for (int64_t i = starts[k]; i < starts[k + 1]; i++)
+                                    {
+                                        sum += points.col(keys[i].index);
+                                    }
+                                    out.col(k) = sum / (double)(starts[k + 1] - starts[k]);
+                                } });
+        return true;
+    }
+
+    // Points with at least minNeighbors other points within radius, in
+    // their order. Neighbours are looked up in the 27 cells of edge
+    // radius around each point. False if the cloud is too wide.
+    inline bool removeOutliers(const Eigen::Ref<const Eigen::Matrix3Xd> &points,
+                               const double radius,
+                               const int minNeighbors,
+                               Eigen::Matrix3Xd &out,
+                               thread_pool::ThreadPool *pool = nullptr)
+    {
+        internal::CellGrid grid;
+        std::vector<internal::CellKey> keys;
+        if (!internal::sortedCells(points, radius, pool, grid, keys))
+        {
+            return false;
+        }
+
+        std::vector<int64_t> starts;
+        internal::cellStarts(keys, starts);
+        const int64_t n = points.cols();
+        const int64_t cells = starts.size() - 1;
+        std::vector<uint64_t> cellKeys(cells);
+        Eigen::Matrix3Xd sorted(3, n);
+        internal::forChunks(n, internal::chunkNum(n, pool), pool,
+                            [&](const int, const int64_t begin, const int64_t end)
+                            {
+                                for (int64_t i = begin; i < end; i++)
+                                {
+                                    sorted.col(i) = points.col(keys[i].index);
+                                } });
+        for (int64_t k = 0; k < cells; k++)
+        {
+            cellKeys[k] = keys[starts[k]].key;
+        }
+
+        // Cells are handled one at a time, so that the up to 27 neighbour
+        // cells are looked up once for all of their points. Cells along x
+        // have consecutive keys, so each of the nine rows of three is a key
+        // range. The ranges only move forward as the cells go up in key
+        // order, so each row keeps a cursor that is searched for once per
+        // chunk and then only advanced.
+        const double radiusSqr = radius * radius;
+        std::vector<char> keep(n);
+        internal::forChunks(cells, internal::chunkNum(cells, pool), pool,
+                            [&](const int, const int64_t begin, const int64_t end)
+                            {
+                                int64_t near[27];
+                                int64_t cursor[9];
+                                std::fill(cursor, cursor + 9, int64_t(-1));
+                                for (int64_t k = begin; k < end; k++)
+                                {
+                                    const int64_t x = grid.coord(cellKeys[k], 0);
+                                    const int64_t y = grid.coord(cellKeys[k], 1);
+                                    const int64_t z = grid.coord(cellKeys[k], 2);
+                                    int num = 0;
+                                    for (int r = 0; r < 9; r++)
+                                    {
+                                        const int64_t ny = y + r % 3 - 1;
+                                        const int64_t nz = z + r / 3 - 1;
+                                        if (ny < 0 || nz < 0)
+                                        {
+                                            continue;
+                                        }
+                                        const uint64_t first = grid.key(std::max<int64_t>(0, x - 1), ny, nz);
+                                        const uint64_t last = grid.key(x + 1, ny, nz);
+                                        int64_t &c = cursor[r];
+                                        if (c < 0)
+                                        {
+                                            c = std::lower_bound(cellKeys.begin(), cellKeys.end(), first) - cellKeys.begin();
+                                        }
+                                        while (c < cells && cellKeys[c] < first)
+                                        {
+                                            c++;
+                                        }
+                                        for (int64_t m = c; m < cells && cellKeys[m] <= last; m++)
+                                        {
+                                            near[num++] = m;
+                                        }
+                                    }
+
+                                    for (int64_t i = starts[k]; i < starts[k + 1]; i++)
+                                    {
+                                        // The point itself is always within radius
+                                        int count = -1;
+                                        for (int c = 0; c < num && count < minNeighbors; c++)
+                                        {
+                                            for (int64_t j = starts[near[c]]; j < starts[near[c] + 1] && count < minNeighbors; j++)
+                                            {
+                                                count += (sorted.col(j) - sorted.col(i)).squaredNorm() <= radiusSqr;
+                                            }
+                                        }
+                                        keep[keys[i].index] = count >= minNeighbors;
+                                    }
+                                } });
+
+        int64_t kept = 0;
+        for (const char k : keep)
+        {
+            kept += k;
+        }
+        out.resize(3, kept);
+        for (int64_t i = 0, k = 0; i < n; i++)
+        {
+            if (keep[i])
+            {
+                out.col(k++) = points.col(i);
+            }
+        }
+        return true;
+    }
+
+    struct PreprocessParams
+    {
+        Eigen::Vector3d cropLow = Eigen::Vector3d::Constant(-INFINITY);
+        Eigen::Vector3d cropHigh = Eigen::Vector3d::Constant(INFINITY);
+        // Stages with a nonpositive size are skipped
+        double leafSize = 0.0;
+        double outlierRadius = 0.0;
+        int minNeighbors = 2;
+    };
+
+    // crop, voxelDownsample and removeOutliers in this order. Outliers are
+    // judged on the downsampled cloud, so minNeighbors counts voxels.
+    inline bool preprocess(const Eigen::Ref<const Eigen::Matrix3Xd> &points,
+                           const PreprocessParams &params,
+                           Eigen::Matrix3Xd &out,
+                           thread_pool::ThreadPool *pool = nullptr)
+    {
+        Eigen::Matrix3Xd cropped;
+        crop(points, params.cropLow, params.cropHigh, cropped, pool);
+        if (params.leafSize > 0.0)
+        {
+            Eigen::Matrix3Xd sampled;
+            if (!voxelDownsample(cropped, params.leafSize, sampled, pool))
+            {
+                return false;
+            }
+            cropped.swap(sampled);
+        }
+        if (params.outlierRadius > 0.0)
+        {
+            return removeOutliers(cropped, params.outlierRadius, params.minNeighbors, out, pool);
+        }
+        out.swap(cropped);
+        return true;
+    }
+
+    inline bool save(const std::string &path,
+                     const Eigen::Ref<const Eigen::Matrix3Xd> &points)
+    {
+        std::ofstream ofs(path, std::ios::binary);
+        const uint64_t count = points.cols();
+        ofs.write(magic, sizeof(magic));
+        ofs.write(reinterpret_cast<const char *>(&version), sizeof(version));
+        ofs.write(reinterpret_cast<const char *>(&count), sizeof(count));
+        for (int64_t i = 0; i < points.cols(); i++)
+        {
+            ofs.write(reinterpret_cast<const char *>(points.col(i).eval().data()), 3 * sizeof(double));
+        }
+        if (!ofs.good())
+        {
+            std::cout << "Cannot write point cloud " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Read-only mapping of a cloud file. The points are paged in by the
+    // kernel on first access and stay valid until close or destruction.
+    class MappedCloud
+    {
+    public:
+        MappedCloud() = default;
+
+        ~MappedCloud()
+        {
+            close();
+        }
+
+        MappedCloud(const MappedCloud &) = delete;
+        MappedCloud &operator=(const MappedCloud &) = delete;
+
+        inline bool open(const std::string &path)
+        {
+            close();
+            const int fd = ::open(path.c_str(), O_RDONLY);
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < headerBytes)
+            {
+                if (fd >= 0)
+                {
+                    ::close(fd);
+                }
+                std::cout << "Cannot read point cloud " << path << std::endl;
+                return false;
+            }
+            void *base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (base == MAP_FAILED)
+            {
+                std::cout << "Cannot map point cloud " << path << std::endl;
+                return false;
+            }
+            mapped = base;
+            length = st.st_size;
+
+            const char *bytes = static_cast<const char *>(base);
+            uint32_t ver;
+            uint64_t count;
+            std::memcpy(&ver, bytes + 4, sizeof(ver));
+            std::memcpy(&count, bytes + 8, sizeof(count));
+            if (std::memcmp(bytes, magic, sizeof(magic)) != 0 || ver != version ||
+                count > (length - headerBytes) / (3 * sizeof(double)) ||
+                length != headerBytes + 3 * sizeof(double) * count)
+            {
+                std::cout << "Cannot read point cloud " << path << std::endl;
+                close();
+                return false;
+            }
+            num = count;
+            return true;
+        }
+
+        inline void close()
+        {
+            if (mapped != nullptr)
+            {
+                munmap(mapped, length);
+            }
+            mapped = nullptr;
+            length = 0;
+            num = 0;
+            return;
+        }
+
+        inline Eigen::Map<const Eigen::Matrix3Xd> points() const
+        {
+            const double *data = mapped == nullptr
+                                     ? nullptr
+                                     : reinterpret_cast<const double *>(static_cast<const char *>(mapped) + headerBytes);
+            return Eigen::Map<const Eigen::Matrix3Xd>(data, 3, num);
+        }
+
+        inline int64_t size() const
+        {
+            return num;
+        }
+
+    private:
+        void *mapped = nullptr;
+        size_t length = 0;
+        int64_t num = 0;
+    };
+
+    // Copies a cloud file into points
+    inline bool load(const std::string &path, Eigen::Matrix3Xd &points)
+    {
+        MappedCloud cloud;
+        if (!cloud.open(path))
+        {
+            return false;
+        }
+        points = cloud.points();
+        return true;
+    }
+
+}
+
+#endif
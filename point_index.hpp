@@ -0,0 +1,201 @@
+#ifndef POINT_INDEX_HPP
+#define POINT_INDEX_HPP
+
+#include <Eigen/Eigen>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace point_index
+{
+
+    // Uniform grid over a point cloud, the points stored cell by cell.
+    // A box query visits only the cells overlapping the box, so its cost
+    // follows the number of points near the box rather than the cloud size.
+    // Points with a NaN or infinite coordinate are left out, as they are
+    // inside no box.
+    class GridIndex
+    {
+    public:
+        GridIndex() = default;
+
+        explicit GridIndex(const std::vector<Eigen::Vector3d> &points,
+                           const double cellSize = 0.0)
+        {
+            build(points, cellSize);
+        }
+
+        explicit GridIndex(const Eigen::Ref<const Eigen::Matrix3Xd> &points,
+                           const double cellSize = 0.0)
+        {
+            build(points, cellSize);
+        }
+
+        // A nonpositive cellSize picks one that puts about pointsPerCell
+        // points in a cell for a uniformly spread cloud
+        inline void build(const std::vector<Eigen::Vector3d> &points,
+                          const double cellSize = 0.0)
+        {
+            build(Eigen::Map<const Eigen::Matrix3Xd>(points.empty() ? nullptr : points[0].data(),
+                                                     3, points.size()),
+                  cellSize);
+            return;
+        }
+
+        inline void build(const Eigen::Ref<const Eigen::Matrix3Xd> &points,
+                          const double cellSize = 0.0)
+        {
+            const int n = points.cols();
+            Eigen::Vector3d lo = Eigen::Vector3d::Constant(INFINITY);
+            Eigen::Vector3d hi = Eigen::Vector3d::Constant(-INFINITY);
+            int m = 0;
+            for (int i = 0; i < n; i++)
+            {
+                if (points.col(i).allFinite())
+                {
+                    lo = lo.cwiseMin(points.col(i));
+                    hi = hi.cwiseMax(points.col(i));
+                    m++;
+                }
+            }
+            sorted.resize(3, m);
+            ids.resize(m);
+            if (m == 0)
+            {
+                origin.setZero();
+                dims.setOnes();
+                cell = 1.0;
+                offsets.assign(2, 0);
+                return;
+            }
+
+            const Eigen::Vector3d extent = (hi - lo).cwiseMax(1.0e-6);
+
+            cell = cellSize > 0.0 ? cellSize
+                                  : std::cbrt(extent.prod() * pointsPerCell / m);
+            cell = std::max(cell, extent.maxCoeff() * 1.0e-6);
+            for (;;)
+            {
+                dims = (extent / cell).array().floor().cast<int>() + 1;
+                if ((int64_t)dims(0) * dims(1) * dims(2) <= maxCells)
+                {
+                    break;
+                }
+                cell *= 1.25;
+            }
+            origin = lo;
+
+            // Counting sort by cell, stable so that each cell lists its
+            // points in their original order. Skipped points get cell -1.
+            const int cellNum = dims(0) * dims(1) * dims(2);
+            offsets.assign(cellNum + 1, 0);
+            std::vector<int> cellOf(n, -1);
+            for (int i = 0; i < n; i++)
+            {
+                if (points.col(i).allFinite())
+                {
+                    cellOf[i] = cellIndex(clampedCoord(points.col(i)));
+                    offsets[cellOf[i] + 1]++;
+                }
+            }
+            for (int c = 0; c < cellNum; c++)
+            {
+                offsets[c + 1] += offsets[c];
+            }
+            std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+            for (int i = 0; i < n; i++)
+            {
+                if (cellOf[i] < 0)
+                {
+                    continue;
+                }
+                const int k = fill[cellOf[i]]++;
+                sorted.col(k) = points.col(i);
+                ids[k] = i;
+            }
+            return;
+        }
+
+        // Appends the points p with lo < p < hi in every coordinate to out,
+        // in their original order. The test is the same as that of the
+        // linear scan in sfc_gen::convexCover.
+        inline void query(const Eigen::Vector3d &lo,
+                          const Eigen::Vector3d &hi,
+                          std::vector<Eigen::Vector3d> &out) const
+        {
+            // Also rejects a NaN bound, which no point is within
+            if (ids.empty() || !((hi - lo).minCoeff() > 0.0))
+            {
+                return;
+            }
+            const Eigen::Vector3i cLo = clampedCoord(lo);
+            const Eigen::Vector3i cHi = clampedCoord(hi);
+
+            // Grown on demand so that repeated queries do not allocate
+            thread_local std::vector<int> hits;
+            hits.clear();
+            for (int z = cLo(2); z <= cHi(2); z++)
+            {
+                for (int y = cLo(1); y <= cHi(1); y++)
+                {
+                    const int row = cellIndex(Eigen::Vector3i(0, y, z));
+                    for (int k = offsets[row + cLo(0)]; k < offsets[row + cHi(0) + 1]; k++)
+                    {
+                        if ((sorted.col(k).array() > lo.array()).all() &&
+                            (sorted.col(k).array() < hi.array()).all())
+                        {
+                            hits.push_back(k);
+                        }
+                    }
+                }
+            }
+
+            std::sort(hits.begin(), hits.end(),
+                      [this](const int l, const int r)
+                      { return ids[l] < ids[r]; });
+            for (const int k : hits)
+            {
+                out.emplace_back(sorted.col(k));
+            }
+            return;
+        }
+
+        // Number of indexed points, the finite ones
+        inline int size() const
+        {
+            return ids.size();
+        }
+
+        inline double getCellSize() const
+        {
+            return cell;
+        }
+
+    private:
+        static constexpr double pointsPerCell = 8.0;
+        static constexpr int64_t maxCells = int64_t(1) << 24;
+
+        Eigen::Vector3d origin = Eigen::Vector3d::Zero();
+        Eigen::Vector3i dims = Eigen::Vector3i::Ones();
+        double cell = 1.0;
+        std::vector<int> offsets;
+        Eigen::Matrix3Xd sorted;
+        std::vector<int> ids;
+
+        inline Eigen::Vector3i clampedCoord(const Eigen::Vector3d &p) const
+        {
+            const Eigen::Vector3d c = ((p - origin) / cell).array().floor();
+            return c.cwiseMax(0.0).cwiseMin((dims.array() - 1).cast<double>().matrix()).cast<int>();
+        }
+
+        inline int cellIndex(const Eigen::Vector3i &c) const
+        {
+            return (c(2) * dims(1) + c(1)) * dims(0) + c(0);
+        }
+    };
+
+}
+
+#endif
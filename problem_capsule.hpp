@@ -0,0 +1,291 @@
+#ifndef PROBLEM_CAPSULE_HPP
+#define PROBLEM_CAPSULE_HPP
+
+#include "trajectory.hpp"
+
+#include <Eigen/Eigen>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace problem_capsule
+{
+
+    // Everything GCOPTER_PolytopeSFC receives for one planning problem,
+    // enough to re-run it deterministically offline
+    struct ProblemCapsule
+    {
+        double timeWeight = 0.0;
+        Eigen::Matrix3d headPVA = Eigen::Matrix3d::Zero();
+        Eigen::Matrix3d tailPVA = Eigen::Matrix3d::Zero();
+        std::vector<Eigen::MatrixX4d> corridor;
+        double lengthPerPiece = 0.0;
+        double smoothingFactor = 0.0;
+        int integralResolution = 0;
+        Eigen::VectorXd magnitudeBounds;
+        Eigen::VectorXd penaltyWeights;
+        Eigen::VectorXd physicalParams;
+
+        std::vector<Trajectory<3>> otherAgents;
+        double swarmThreshold = 1.0;
+        Eigen::Matrix3d swarmEllipsoid = Eigen::Matrix3d::Identity();
+
+        double relCostTol = 1.0e-4;
+        uint64_t randSeed = 0;
+        bool boxCorridor = false;
+        // Of the vertex cache, which does not change the result
+        uint64_t vertexCacheCapacity = 0;
+
+        // Wall-clock budget of the optimization in seconds from its start,
+        // <= 0 for none. For optimize it is the time left to the deadline.
+        double timeBudget = 0.0;
+        // Iteration at which the observer or cancel token stopped the
+        // solve, -1 if they did not
+        int stopIteration = -1;
+
+        // Set when the solve ran through optimizeAnytime, which then took
+        // timeBudget, relCostTol and the settings below
+        bool anytime = false;
+        double velSlack = 0.0;
+        double corridorSlack = 1.0e-3;
+        int checkResolution = 8;
+        bool escalateResolution = false;
+        int initialResolution = 2;
+    };
+
+    // Binary layout, all values in host byte order:
+    //   "GCAP", uint32 version, then the fields of ProblemCapsule in order.
+    //   Matrices are int32 rows, int32 cols and col-major doubles,
+    //   trajectories are int32 piece count and per piece the duration
+    //   followed by the 3x4 coefficient matrix, flags are uint8.
+    constexpr char magic[4] = {'G', 'C', 'A', 'P'};
+    constexpr uint32_t version = 4;
+
+    namespace internal
+    {
+        // Guards against corrupted files requesting huge allocations
+        constexpr int32_t maxCount = 1 << 24;
+
+        template <typename T>
+        inline void put(std::ostream &os, const T &val)
+        {
+            os.write(reinterpret_cast<const char *>(&val), sizeof(T));
+            return;
+        }
+
+        template <typename T>
+        inline bool get(std::istream &is, T &val)
+        {
+            return (bool)is.read(reinterpret_cast<char *>(&val), sizeof(T));
+        }
+
+        template <typename Derived>
+        inline void putMat(std::ostream &os, const Eigen::MatrixBase<Derived> &mat)
+        {
+            const Eigen::MatrixXd m = mat;
+            put(os, (int32_t)m.rows());
+            put(os, (int32_t)m.cols());
+            os.write(reinterpret_cast<const char *>(m.data()), sizeof(double) * m.size());
+            return;
+        }
+
+        template <typename Mat>
+        inline bool getMat(std::istream &is, Mat &mat)
+        {
+            int32_t rows, cols;
+            if (!get(is, rows) || !get(is, cols) ||
+                rows < 0 || cols < 0 || (int64_t)rows * cols > maxCount ||
+                (Mat::RowsAtCompileTime != Eigen::Dynamic && rows != Mat::RowsAtCompileTime) ||
+                (Mat::ColsAtCompileTime != Eigen::Dynamic && cols != Mat::ColsAtCompileTime))
+            {
+                return false;
+            }
+            mat.resize(rows, cols);
+            return (bool)is.read(reinterpret_cast<char *>(mat.data()), sizeof(double) * mat.size());
+        }
+
+        inline void putTraj(std::ostream &os, const Trajectory<3> &traj)
+        {
+            put(os, (int32_t)traj.getPieceNum());
+            for (int i = 0; i < traj.getPieceNum(); i++)
+            {
+                put(os, traj[i].getDuration());
+                putMat(os, traj[i].getCoeffMat());
+            }
+            return;
+        }
+
+        inline bool getTraj(std::istream &is, Trajectory<3> &traj)
+        {
+            int32_t n;
+            if (!get(is, n) || n < 0 || n > maxCount)
+            {
+                return false;
+            }
+            traj.clear();
+            traj.reserve(n);
+            double dur;
+            Piece<3>::CoefficientMat cMat;
+            for (int i = 0; i < n; i++)
+            {
+                if (!get(is, dur) || !getMat(is, cMat))
+                {
+                    return false;
+                }
+                traj.emplace_back(dur, cMat);
+            }
+            return true;
+        }
+    }
+
+    inline bool write(std::ostream &os, const ProblemCapsule &cap)
+    {
+        using namespace internal;
+        os.write(magic, sizeof(magic));
+        put(os, version);
+
+        put(os, cap.timeWeight);
+        putMat(os, cap.headPVA);
+        putMat(os, cap.tailPVA);
+        put(os, (int32_t)cap.corridor.size());
+        for (const Eigen::MatrixX4d &hPoly : cap.corridor)
+        {
+            putMat(os, hPoly);
+        }
+        put(os, cap.lengthPerPiece);
+        put(os, cap.smoothingFactor);
+        put(os, (int32_t)cap.integralResolution);
+        putMat(os, cap.magnitudeBounds);
+        putMat(os, cap.penaltyWeights);
+        putMat(os, cap.physicalParams);
+
+        put(os, (int32_t)cap.otherAgents.size());
+        for (const Trajectory<3> &traj : cap.otherAgents)
+        {
+            putTraj(os, traj);
+        }
+        put(os, cap.swarmThreshold);
+        putMat(os, cap.swarmEllipsoid);
+
+        put(os, cap.relCostTol);
+        put(os, cap.randSeed);
+        put(os, (uint8_t)cap.boxCorridor);
+        put(os, cap.vertexCacheCapacity);
+
+        put(os, cap.timeBudget);
+        put(os, (int32_t)cap.stopIteration);
+        put(os, (uint8_t)cap.anytime);
+        put(os, cap.velSlack);
+        put(os, cap.corridorSlack);
+        put(os, (int32_t)cap.checkResolution);
+        put(os, (uint8_t)cap.escalateResolution);
+        put(os, (int32_t)cap.initialResolution);
+
+        return (bool)os;
+    }
+
+    inline bool read(std::istream &is, ProblemCapsule &cap)
+    {
+        using namespace internal;
+        char head[4];
+        uint32_t ver;
+        if (!is.read(head, sizeof(head)) ||
+            std::memcmp(head, magic, sizeof(magic)) != 0 ||
+            !get(is, ver) || ver != version)
+        {
+            return false;
+        }
+
+        int32_t n, res;
+        if (!get(is, cap.timeWeight) ||
+            !getMat(is, cap.headPVA) ||
+            !getMat(is, cap.tailPVA) ||
+            !get(is, n) || n < 0 || n > maxCount)
+        {
+            return false;
+        }
+        cap.corridor.resize(n);
+        for (Eigen::MatrixX4d &hPoly : cap.corridor)
+        {
+            if (!getMat(is, hPoly))
+            {
+                return false;
+            }
+        }
+        if (!get(is, cap.lengthPerPiece) ||
+            !get(is, cap.smoothingFactor) ||
+            !get(is, res) ||
+            !getMat(is, cap.magnitudeBounds) ||
+            !getMat(is, cap.penaltyWeights) ||
+            !getMat(is, cap.physicalParams) ||
+            !get(is, n) || n < 0 || n > maxCount)
+        {
+            return false;
+        }
+        cap.integralResolution = res;
+        cap.otherAgents.resize(n);
+        for (Trajectory<3> &traj : cap.otherAgents)
+        {
+            if (!getTraj(is, traj))
+            {
+                return false;
+            }
+        }
+
+        uint8_t box, anytime, escalate;
+        int32_t stop, checkRes, initialRes;
+        if (!get(is, cap.swarmThreshold) ||
+            !getMat(is, cap.swarmEllipsoid) ||
+            !get(is, cap.relCostTol) ||
+            !get(is, cap.randSeed) ||
+            !get(is, box) ||
+            !get(is, cap.vertexCacheCapacity) ||
+            !get(is, cap.timeBudget) ||
+            !get(is, stop) ||
+            !get(is, anytime) ||
+            !get(is, cap.velSlack) ||
+            !get(is, cap.corridorSlack) ||
+            !get(is, checkRes) ||
+            !get(is, escalate) ||
+            !get(is, initialRes))
+        {
+            return false;
+        }
+        cap.boxCorridor = box != 0;
+        cap.stopIteration = stop;
+        cap.anytime = anytime != 0;
+        cap.checkResolution = checkRes;
+        cap.escalateResolution = escalate != 0;
+        cap.initialResolution = initialRes;
+        return true;
+    }
+
+    inline bool save(const std::string &path, const ProblemCapsule &cap)
+    {
+        std::ofstream ofs(path, std::ios::binary);
+        if (!ofs.is_open() || !write(ofs, cap))
+        {
+            std::cout << "Cannot write problem capsule " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    inline bool load(const std::string &path, ProblemCapsule &cap)
+    {
+        std::ifstream ifs(path, std::ios::binary);
+        if (!ifs.is_open() || !read(ifs, cap))
+        {
+            std::cout << "Cannot read problem capsule " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+}
+
+#endif
@@ -12,7 +12,6 @@
 #include <algorithm>
 #include <array>
 #include <vector>
-#include <deque>
 #include <unordered_map>
 #include <fstream>
 #include <cassert>
@@ -926,7 +925,15 @@ namespace quickhull
             FaceData(size_t fi, size_t he) : m_faceIndex(fi), m_enteredFromHalfEdge(he) {}
         };
         std::vector<FaceData> m_possiblyVisibleFaces;
-        std::deque<size_t> m_faceList;
+        // FIFO of faces to process, consumed from m_faceListHead on so that
+        // the storage is kept between builds
+        std::vector<size_t> m_faceList;
+        size_t m_faceListHead;
+
+        // Output of getConvexHullIndices, kept between calls
+        std::vector<std::uint8_t> m_faceProcessed;
+        std::vector<size_t> m_faceStack;
+        std::vector<size_t> m_indexBuffer;
 
         // Create a half edge mesh representing the base tetrahedron from which the QuickHull
         // iteration proceeds. m_extremeValues must be properly set up when this is called.
@@ -1037,7 +1044,7 @@ namespace quickhull
             Plane<T> trianglePlane(N, baseTriangleVertices[0]);
             for (size_t i = 0; i < vCount; i++)
             {
-                const T d = abs(mathutils::getSignedDistanceToPlane(m_vertexData[i], trianglePlane));
+                const T d = std::abs(mathutils::getSignedDistanceToPlane(m_vertexData[i], trianglePlane));
                 if (d > maxD)
                 {
                     maxD = d;
@@ -1212,12 +1219,22 @@ namespace quickhull
             m_horizonEdges.clear();
             m_possiblyVisibleFaces.clear();
 
+            // Point vectors left on faces of the previous build go back to the pool
+            for (auto &face : m_mesh.m_faces)
+            {
+                if (face.m_pointsOnPositiveSide)
+                {
+                    reclaimToIndexVectorPool(face.m_pointsOnPositiveSide);
+                }
+            }
+
             // Compute base tetrahedron
             setupInitialTetrahedron();
             assert(m_mesh.m_faces.size() == 4);
 
             // Init face stack with those faces that have points assigned to them
             m_faceList.clear();
+            m_faceListHead = 0;
             auto &f = m_mesh.m_faces;
 
             if (f[0].m_pointsOnPositiveSide &&
@@ -1247,7 +1264,7 @@ namespace quickhull
 
             // Process faces until the face list is empty.
             size_t iter = 0;
-            while (!m_faceList.empty())
+            while (m_faceListHead < m_faceList.size())
             {
                 iter++;
                 if (iter == std::numeric_limits<size_t>::max())
@@ -1259,8 +1276,7 @@ namespace quickhull
                     iter = 0;
                 }
 
-                const size_t topFaceIndex = m_faceList.front();
-                m_faceList.pop_front();
+                const size_t topFaceIndex = m_faceList[m_faceListHead++];
 
                 auto &tf = m_mesh.m_faces[topFaceIndex];
                 tf.m_inFaceStack = 0;
@@ -1473,9 +1489,6 @@ namespace quickhull
                     }
                 }
             }
-
-            // Cleanup
-            m_indexVectorPool.clear();
         }
 
         // Constructs the convex hull into a MeshBuilder object
@@ -1622,6 +1635,62 @@ namespace quickhull
             return HalfEdgeMesh<T, size_t>(m_mesh, m_vertexData);
         }
 
+        // Same triangles as getConvexHull(vertexData, vertexCount, CCW, true, eps)
+        // without building a ConvexHull object. All buffers, the returned one
+        // included, are kept by this object, so a QuickHull reused for many
+        // hulls stops allocating once they have grown. The returned buffer is
+        // overwritten by the next call.
+        inline const std::vector<size_t> &getConvexHullIndices(const T *vertexData,
+                                                               size_t vertexCount,
+                                                               bool CCW,
+                                                               T eps = defaultEps<T>())
+        {
+            VertexDataSource<T> vertexDataSource((const vec3 *)vertexData, vertexCount);
+            buildMesh(vertexDataSource, CCW, true, eps);
+
+            // Same face traversal as the ConvexHull constructor
+            const auto &mesh = m_mesh;
+            m_indexBuffer.clear();
+            m_faceStack.clear();
+            m_faceProcessed.assign(mesh.m_faces.size(), 0);
+            for (size_t i = 0; i < mesh.m_faces.size(); i++)
+            {
+                if (!mesh.m_faces[i].isDisabled())
+                {
+                    m_faceStack.push_back(i);
+                    break;
+                }
+            }
+
+            const size_t iCCW = CCW ? 1 : 0;
+            while (m_faceStack.size())
+            {
+                const size_t top = m_faceStack.back();
+                m_faceStack.pop_back();
+                if (m_faceProcessed[top])
+                {
+                    continue;
+                }
+                m_faceProcessed[top] = 1;
+                auto halfEdges = mesh.getHalfEdgeIndicesOfFace(mesh.m_faces[top]);
+                size_t adjacent[] = {mesh.m_halfEdges[mesh.m_halfEdges[halfEdges[0]].m_opp].m_face,
+                                     mesh.m_halfEdges[mesh.m_halfEdges[halfEdges[1]].m_opp].m_face,
+                                     mesh.m_halfEdges[mesh.m_halfEdges[halfEdges[2]].m_opp].m_face};
+                for (auto a : adjacent)
+                {
+                    if (!m_faceProcessed[a] && !mesh.m_faces[a].isDisabled())
+                    {
+                        m_faceStack.push_back(a);
+                    }
+                }
+                const auto vertices = mesh.getVertexIndicesOfFace(mesh.m_faces[top]);
+                m_indexBuffer.push_back(vertices[0]);
+                m_indexBuffer.push_back(vertices[1 + iCCW]);
+                m_indexBuffer.push_back(vertices[2 - iCCW]);
+            }
+            return m_indexBuffer;
+        }
+
         // Get diagnostics about last generated convex hull
         inline const DiagnosticsData &getDiagnostics()
         {
@@ -0,0 +1,326 @@
+#ifndef SCENARIO_GEN_HPP
+#define SCENARIO_GEN_HPP
+
+#include "planner_pool.hpp"
+#include "firi.hpp"
+#include "geo_utils.hpp"
+#include "minco.hpp"
+#include "trajectory.hpp"
+
+#include <Eigen/Eigen>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace scenario_gen
+{
+
+    enum CorridorType
+    {
+        CORRIDOR_BOX_CHAIN = 0,
+        CORRIDOR_FIRI,
+        CORRIDOR_MIXED
+    };
+
+    // Ranges every scenario is drawn from, all lengths in meters
+    struct ScenarioParams
+    {
+        int corridorType = CORRIDOR_MIXED;
+
+        // Number of corridor polytopes and the distance between their seeds
+        int minPolytopes = 4;
+        int maxPolytopes = 24;
+        double minStep = 0.6;
+        double maxStep = 1.5;
+        // Turn of the seed path per step in radians and its climb rate
+        double maxTurn = 0.8;
+        double maxClimb = 0.3;
+
+        // Box half sizes of box chains
+        double minHalfSize = 0.8;
+        double maxHalfSize = 2.0;
+
+        // Obstacles per polytope of FIRI corridors, which sets the face count,
+        // and the clearance kept around the seed path
+        int minObstacles = 10;
+        int maxObstacles = 200;
+        double clearance = 0.4;
+
+        double minLengthPerPiece = 1.0;
+        double maxLengthPerPiece = 4.0;
+
+        // Fraction of v_max of the boundary velocities
+        double maxBoundarySpeed = 0.5;
+
+        int minAgents = 0;
+        int maxAgents = 3;
+        double agentSpeed = 1.0;
+        // Fraction of neighbours that fly through a point of the seed path,
+        // the others pass agentClearance above it. Crossings may leave no
+        // feasible solution, such solves are reported as failures.
+        double agentCrossRate = 0.5;
+        double agentClearance = 2.0;
+
+        double timeWeight = 20.0;
+        double smoothingFactor = 1.0e-2;
+        int integralResolution = 8;
+        double relCostTol = 1.0e-4;
+        // Speed over v_max a solve may keep and still count as feasible,
+        // as the smoothed penalty lets converged solves touch the bound
+        double velSlack = 1.0e-2;
+
+        ScenarioParams()
+            : magnitudeBounds(5),
+              penaltyWeights(5),
+              physicalParams(6)
+        {
+            magnitudeBounds << 4.0, 10.0, 1.05, 2.0, 12.0;
+            penaltyWeights << 1.0e3, 1.0e3, 1.0e3, 1.0e3, 1.0e4;
+            physicalParams << 0.61, 9.8, 0.70, 0.80, 0.01, 0.0001;
+        }
+
+        Eigen::VectorXd magnitudeBounds;
+        Eigen::VectorXd penaltyWeights;
+        Eigen::VectorXd physicalParams;
+    };
+
+    // Draws randomized planning problems from a seeded engine, so the
+    // same seed and params always give the same sequence of scenarios
+    class ScenarioGenerator
+    {
+    public:
+        explicit ScenarioGenerator(const uint64_t seed = std::mt19937_64::default_seed,
+                                   const ScenarioParams &params = ScenarioParams())
+            : gen(seed), prm(params) {}
+
+        inline const ScenarioParams &params() const
+        {
+            return prm;
+        }
+
+        // Fills req with a new scenario, the seed path is returned in path
+        inline void generate(planner_pool::PlanRequest &req,
+                             Eigen::Matrix3Xd &path)
+        {
+            const int num = uniformInt(prm.minPolytopes, prm.maxPolytopes);
+            seedPath(num, path);
+
+            int type = prm.corridorType;
+            if (type == CORRIDOR_MIXED)
+            {
+                type = uniformInt(0, 1) == 0 ? CORRIDOR_BOX_CHAIN : CORRIDOR_FIRI;
+            }
+            req.corridor.clear();
+            if (type == CORRIDOR_FIRI)
+            {
+                firiCorridor(path, req.corridor);
+            }
+            else
+            {
+                boxChain(path, req.corridor);
+            }
+
+            const double vBound = prm.magnitudeBounds(0) * prm.maxBoundarySpeed;
+            req.headPVA.setZero();
+            req.tailPVA.setZero();
+            req.headPVA.col(0) = path.col(0);
+            req.tailPVA.col(0) = path.col(path.cols() - 1);
+            req.headPVA.col(1) = (path.col(1) - path.col(0)).normalized() * uniform(0.0, vBound);
+            req.tailPVA.col(1) = (path.col(path.cols() - 1) - path.col(path.cols() - 2)).normalized() *
+                                 uniform(0.0, vBound);
+
+            req.timeWeight = prm.timeWeight;
+            req.lengthPerPiece = uniform(prm.minLengthPerPiece, prm.maxLengthPerPiece);
+            req.smoothingFactor = prm.smoothingFactor;
+            req.integralResolution = prm.integralResolution;
+            req.magnitudeBounds = prm.magnitudeBounds;
+            req.penaltyWeights = prm.penaltyWeights;
+            req.physicalParams = prm.physicalParams;
+            req.relCostTol = prm.relCostTol;
+            req.anytimeParams.velSlack = prm.velSlack;
+            req.randSeed = gen();
+
+            const int agents = uniformInt(prm.minAgents, prm.maxAgents);
+            req.otherAgents.resize(agents);
+            for (int i = 0; i < agents; i++)
+            {
+                crossingAgent(path, req.otherAgents[i]);
+            }
+            return;
+        }
+
+        inline planner_pool::PlanRequest next()
+        {
+            planner_pool::PlanRequest req;
+            Eigen::Matrix3Xd path;
+            generate(req, path);
+            return req;
+        }
+
+    private:
+        std::mt19937_64 gen;
+        ScenarioParams prm;
+
+        inline double uniform(const double lo, const double hi)
+        {
+            return std::uniform_real_distribution<double>(lo, hi)(gen);
+        }
+
+        inline int uniformInt(const int lo, const int hi)
+        {
+            return std::uniform_int_distribution<int>(lo, std::max(lo, hi))(gen);
+        }
+
+        // A smooth random walk with num + 1 vertices starting at the origin
+        inline void seedPath(const int num, Eigen::Matrix3Xd &path)
+        {
+            path.resize(3, num + 1);
+            path.col(0).setZero();
+            double yaw = uniform(-M_PI, M_PI);
+            for (int i = 1; i <= num; i++)
+            {
+                yaw += uniform(-prm.maxTurn, prm.maxTurn);
+                const double step = uniform(prm.minStep, prm.maxStep);
+                path.col(i) = path.col(i - 1) +
+                              step * Eigen::Vector3d(std::cos(yaw), std::sin(yaw),
+                                                     uniform(-prm.maxClimb, prm.maxClimb));
+            }
+            return;
+        }
+
+        // A randomly padded box around each path segment, consecutive
+        // boxes share a path vertex in their interior and thus overlap
+        inline void boxChain(const Eigen::Matrix3Xd &path,
+                             gcopter::GCOPTER_PolytopeSFC::PolyhedraH &corridor)
+        {
+            const int num = path.cols() - 1;
+            for (int i = 0; i < num; i++)
+            {
+                const Eigen::Vector3d a = path.col(i);
+                const Eigen::Vector3d b = path.col(i + 1);
+                Eigen::Vector3d lo, hi;
+                for (int k = 0; k < 3; k++)
+                {
+                    const double h = uniform(prm.minHalfSize, prm.maxHalfSize);
+                    lo(k) = std::min(a(k), b(k)) - h;
+                    hi(k) = std::max(a(k), b(k)) + h;
+                }
+                corridor.push_back(box(lo, hi));
+            }
+            return;
+        }
+
+        // FIRI polytopes grown along each path segment in a random point
+        // cloud that leaves some clearance around the path
+        inline void firiCorridor(const Eigen::Matrix3Xd &path,
+                                 gcopter::GCOPTER_PolytopeSFC::PolyhedraH &corridor)
+        {
+            const int num = path.cols() - 1;
+            const double margin = 3.0;
+            Eigen::MatrixX4d hPoly;
+            for (int i = 0; i < num; i++)
+            {
+                const Eigen::Vector3d a = path.col(i);
+                const Eigen::Vector3d b = path.col(i + 1);
+                const Eigen::Vector3d lo = a.cwiseMin(b).array() - margin;
+                const Eigen::Vector3d hi = a.cwiseMax(b).array() + margin;
+                const Eigen::MatrixX4d bd = box(lo, hi);
+
+                const int obsNum = uniformInt(prm.minObstacles, prm.maxObstacles);
+                Eigen::Matrix3Xd pc(3, obsNum);
+                int count = 0;
+                while (count < obsNum)
+                {
+                    const Eigen::Vector3d p(uniform(lo(0), hi(0)),
+                                            uniform(lo(1), hi(1)),
+                                            uniform(lo(2), hi(2)));
+                    if (pathDistance(path, p) > prm.clearance)
+                    {
+                        pc.col(count++) = p;
+                    }
+                }
+
+                if (firi::firi(bd, pc, a, b, hPoly) &&
+                    (corridor.empty() || geo_utils::overlap(corridor.back(), hPoly)))
+                {
+                    corridor.push_back(hPoly);
+                }
+                else
+                {
+                    // Degenerate draws fall back to a box around the segment
+                    corridor.push_back(box(a.cwiseMin(b).array() - prm.clearance,
+                                           a.cwiseMax(b).array() + prm.clearance));
+                }
+            }
+            return;
+        }
+
+        // A neighbour flying straight through or past a random point of
+        // the path
+        inline void crossingAgent(const Eigen::Matrix3Xd &path,
+                                  Trajectory<3> &traj)
+        {
+            const int k = uniformInt(0, path.cols() - 1);
+            const double yaw = uniform(-M_PI, M_PI);
+            const Eigen::Vector3d dir(std::cos(yaw), std::sin(yaw), 0.0);
+            const double halfLength = uniform(2.0, 6.0);
+            const bool crosses = uniform(0.0, 1.0) < prm.agentCrossRate;
+            const Eigen::Vector3d center = path.col(k) +
+                                           Eigen::Vector3d(0.0, 0.0, crosses ? 0.0 : prm.agentClearance);
+
+            const int pieces = 4;
+            Eigen::Matrix3d head = Eigen::Matrix3d::Zero();
+            Eigen::Matrix3d tail = Eigen::Matrix3d::Zero();
+            head.col(0) = center - halfLength * dir;
+            tail.col(0) = center + halfLength * dir;
+            head.col(1) = prm.agentSpeed * dir;
+            tail.col(1) = prm.agentSpeed * dir;
+            Eigen::Matrix3Xd inPs(3, pieces - 1);
+            for (int i = 1; i < pieces; i++)
+            {
+                inPs.col(i - 1) = head.col(0) + (tail.col(0) - head.col(0)) * i / pieces;
+            }
+            const Eigen::VectorXd ts = Eigen::VectorXd::Constant(
+                pieces, 2.0 * halfLength / (pieces * prm.agentSpeed));
+
+            minco::MINCO_S2NU minco;
+            minco.setConditions(head, tail, pieces);
+            minco.setParameters(inPs, ts);
+            minco.getTrajectory(traj);
+            return;
+        }
+
+        static inline Eigen::MatrixX4d box(const Eigen::Vector3d &lo,
+                                           const Eigen::Vector3d &hi)
+        {
+            Eigen::MatrixX4d hPoly(6, 4);
+            hPoly << 1.0, 0.0, 0.0, -hi(0),
+                -1.0, 0.0, 0.0, lo(0),
+                0.0, 1.0, 0.0, -hi(1),
+                0.0, -1.0, 0.0, lo(1),
+                0.0, 0.0, 1.0, -hi(2),
+                0.0, 0.0, -1.0, lo(2);
+            return hPoly;
+        }
+
+        static inline double pathDistance(const Eigen::Matrix3Xd &path,
+                                          const Eigen::Vector3d &p)
+        {
+            double dist = INFINITY;
+            for (int i = 0; i + 1 < path.cols(); i++)
+            {
+                const Eigen::Vector3d a = path.col(i);
+                const Eigen::Vector3d ab = path.col(i + 1) - a;
+                const double t = std::clamp((p - a).dot(ab) / ab.squaredNorm(), 0.0, 1.0);
+                dist = std::min(dist, (a + t * ab - p).norm());
+            }
+            return dist;
+        }
+    };
+
+}
+
+#endif
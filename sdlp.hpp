@@ -26,9 +26,14 @@
 #ifndef SDLP_HPP
 #define SDLP_HPP
 
+#include "thread_pool.hpp"
+
 #include <Eigen/Eigen>
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <random>
+#include <vector>
 
 namespace sdlp
 {
@@ -683,13 +688,26 @@ namespace sdlp
         }
     }
 
+    /* random engine of the calling thread, used to shuffle the input planes */
+    inline std::mt19937_64 &rand_engine()
+    {
+        thread_local std::mt19937_64 gen;
+        return gen;
+    }
+
+    /* reseed the engine of the calling thread for reproducible results */
+    inline void rand_seed(const uint64_t seed)
+    {
+        rand_engine().seed(seed);
+    }
+
     inline void rand_permutation(const int n,
-                                 int *p)
+                                 int *p,
+                                 std::mt19937_64 &gen)
     {
         typedef std::uniform_int_distribution<int> rand_int;
         typedef rand_int::param_type rand_range;
-        static std::mt19937_64 gen;
-        static rand_int rdi(0, 1);
+        rand_int rdi(0, 1);
         int j, k;
         for (int i = 0; i < n; i++)
         {
@@ -705,14 +723,70 @@ namespace sdlp
         }
     }
 
+    inline void rand_permutation(const int n,
+                                 int *p)
+    {
+        rand_permutation(n, p, rand_engine());
+    }
+
+    /* advances gen exactly as far as shuffling n planes does */
+    inline void rand_discard(const int n,
+                             std::mt19937_64 &gen)
+    {
+        typedef std::uniform_int_distribution<int> rand_int;
+        typedef rand_int::param_type rand_range;
+        rand_int rdi(0, 1);
+        for (int i = 0; i < n; i++)
+        {
+            rdi.param(rand_range(0, n - i - 1));
+            rdi(gen);
+        }
+    }
+
+    /* buffers of linprog, grown on demand and kept between solves */
+    template <int d>
+    struct LPContext
+    {
+        Eigen::VectorXi perm;
+        Eigen::VectorXi next;
+        Eigen::VectorXi prev;
+        Eigen::Matrix<double, d + 1, -1, Eigen::ColMajor> halves;
+        Eigen::VectorXd work;
+
+        /* room for m planes, the first one being the homogeneous plane */
+        inline void reserve(const int m)
+        {
+            if (next.size() < m)
+            {
+                perm.resize(m - 1);
+                next.resize(m);
+                prev.resize(m + 1);
+                halves.resize(d + 1, m);
+                work.resize((m + 3) * (d + 2) * (d - 1) / 2);
+            }
+        }
+    };
+
+    /* context of the calling thread, used when none is given */
+    template <int d>
+    inline LPContext<d> &lp_context()
+    {
+        thread_local LPContext<d> ctx;
+        return ctx;
+    }
+
     template <int d>
     inline double linprog(const Eigen::Matrix<double, d, 1> &c,
-                          const Eigen::Matrix<double, -1, d> &A,
-                          const Eigen::Matrix<double, -1, 1> &b,
-                          Eigen::Matrix<double, d, 1> &x)
+                          const Eigen::Ref<const Eigen::Matrix<double, -1, d>> &A,
+                          const Eigen::Ref<const Eigen::VectorXd> &b,
+                          Eigen::Matrix<double, d, 1> &x,
+                          std::mt19937_64 &gen,
+                          LPContext<d> &ctx)
     /*
     **  min cTx, s.t. Ax<=b
     **  dim(x) << dim(b)
+    **  gen is only used to shuffle the constraints and ctx only holds
+    **  buffers, so that caller-owned ones make the solve reentrant
     */
     {
         int m = b.size() + 1;
@@ -722,29 +796,32 @@ namespace sdlp
             return c.cwiseAbs().maxCoeff() > 0.0 ? -INFINITY : 0.0;
         }
 
-        Eigen::VectorXi perm(m - 1);
-        Eigen::VectorXi next(m);
+        ctx.reserve(m);
+        Eigen::VectorXi &perm = ctx.perm;
+        Eigen::VectorXi &next = ctx.next;
         /* original allocated size is m, here changed to m + 1 for legal tail accessing */
-        Eigen::VectorXi prev(m + 1);
+        Eigen::VectorXi &prev = ctx.prev;
         Eigen::Matrix<double, d + 1, 1> n_vec;
         Eigen::Matrix<double, d + 1, 1> d_vec;
         Eigen::Matrix<double, d + 1, 1> opt;
-        Eigen::Matrix<double, d + 1, -1, Eigen::ColMajor> halves(d + 1, m);
-        Eigen::VectorXd work((m + 3) * (d + 2) * (d - 1) / 2);
+        auto halves = ctx.halves.leftCols(m);
 
         halves.col(0).setZero();
         halves(d, 0) = 1.0;
         halves.topRightCorner(d, m - 1) = -A.transpose();
         halves.bottomRightCorner(1, m - 1) = b.transpose();
-        /* normalize all halves as required in linfracprog */
-        halves.colwise().normalize();
+        /* normalize all halves as required in linfracprog, column by column to avoid a temporary */
+        for (int i = 0; i < m; i++)
+        {
+            halves.col(i) /= halves.col(i).norm();
+        }
         n_vec.head(d) = c;
         n_vec(d) = 0.0;
         d_vec.setZero();
         d_vec(d) = 1.0;
 
         /* randomize the input planes */
-        rand_permutation(m - 1, perm.data());
+        rand_permutation(m - 1, perm.data(), gen);
         /* previous to 0 is actually never used */
         prev(0) = 0;
         /* link the zero position in at the beginning */
@@ -759,9 +836,9 @@ namespace sdlp
         /* flag the last plane */
         next(perm(m - 2) + 1) = m;
 
-        int status = sdlp::linfracprog<d>(halves.data(), m, m,
+        int status = sdlp::linfracprog<d>(ctx.halves.data(), m, m,
                                           n_vec.data(), d_vec.data(),
-                                          opt.data(), work.data(),
+                                          opt.data(), ctx.work.data(),
                                           next.data(), prev.data());
 
         /* handle states for linprog whose definitions differ from linfracprog */
@@ -784,6 +861,72 @@ namespace sdlp
         return minimum;
     }
 
+    template <int d>
+    inline double linprog(const Eigen::Matrix<double, d, 1> &c,
+                          const Eigen::Ref<const Eigen::Matrix<double, -1, d>> &A,
+                          const Eigen::Ref<const Eigen::VectorXd> &b,
+                          Eigen::Matrix<double, d, 1> &x,
+                          std::mt19937_64 &gen)
+    /*
+    **  same as above, using the buffers of the calling thread
+    */
+    {
+        return linprog<d>(c, A, b, x, gen, lp_context<d>());
+    }
+
+    template <int d>
+    inline double linprog(const Eigen::Matrix<double, d, 1> &c,
+                          const Eigen::Ref<const Eigen::Matrix<double, -1, d>> &A,
+                          const Eigen::Ref<const Eigen::VectorXd> &b,
+                          Eigen::Matrix<double, d, 1> &x)
+    /*
+    **  same as above, using the engine of the calling thread
+    */
+    {
+        return linprog<d>(c, A, b, x, rand_engine(), lp_context<d>());
+    }
+
+    template <int d>
+    inline void linprog_batch(const std::vector<Eigen::Matrix<double, d, 1>> &cs,
+                              const Eigen::Matrix<double, -1, d> &A,
+                              const Eigen::VectorXd &b,
+                              const std::vector<int> &offsets,
+                              std::vector<std::mt19937_64> &gens,
+                              std::vector<Eigen::Matrix<double, d, 1>> &xs,
+                              std::vector<double> &minima,
+                              thread_pool::ThreadPool *pool = nullptr)
+    /*
+    **  solves the independent problems min cs[i]Tx, s.t. Aix<=bi where
+    **  Ai and bi are rows offsets[i] to offsets[i+1] of A and b
+    **  problem i is shuffled by gens[i] alone, so the results do not
+    **  depend on the pool; each problem runs on the LP
+    **  context of the thread that takes it, which the pool workers keep
+    **  across calls; no pool solves all of them on the calling thread
+    */
+    {
+        const int num = cs.size();
+        xs.resize(num);
+        minima.resize(num);
+        const auto solve = [&](const int i)
+        {
+            const int m = offsets[i + 1] - offsets[i];
+            minima[i] = linprog<d>(cs[i], A.middleRows(offsets[i], m),
+                                   b.segment(offsets[i], m), xs[i],
+                                   gens[i], lp_context<d>());
+        };
+
+        if (pool == nullptr)
+        {
+            for (int i = 0; i < num; i++)
+            {
+                solve(i);
+            }
+            return;
+        }
+        pool->parallelFor(num, solve);
+        return;
+    }
+
 } // namespace sdlp
 
 #endif
@@ -27,21 +27,32 @@
 
 #include "geo_utils.hpp"
 #include "firi.hpp"
+#include "point_index.hpp"
+#include "thread_pool.hpp"
 
+// planPath needs OMPL, define SFC_GEN_NO_OMPL to leave it out
+#ifndef SFC_GEN_NO_OMPL
 #include <ompl/util/Console.h>
 #include <ompl/base/SpaceInformation.h>
 #include <ompl/base/spaces/RealVectorStateSpace.h>
 #include <ompl/geometric/planners/rrt/InformedRRTstar.h>
 #include <ompl/base/objectives/PathLengthOptimizationObjective.h>
 #include <ompl/base/DiscreteMotionValidator.h>
+#endif
 
+#include <algorithm>
 #include <deque>
 #include <memory>
+#include <numeric>
+#include <vector>
 #include <Eigen/Eigen>
 
 namespace sfc_gen
 {
 
+#ifndef SFC_GEN_NO_OMPL
+    // grid_search::planPath takes the same arguments with a lattice step
+    // in place of the timeout, and is deterministic without OMPL
     template <typename Map>
     inline double planPath(const Eigen::Vector3d &s,
                            const Eigen::Vector3d &g,
@@ -112,15 +123,23 @@ namespace sfc_gen
 
         return cost;
     }
+#endif
 
+    // Obstacle points are looked up through a GridIndex, which can be built
+    // once and reused across calls on the same map. With warm given, the
+    // FIRI of segment k is warm started from (*warm)[k] of the last call,
+    // so a replan along a nearly unchanged path mostly reuses polytopes.
+    // Each FIRI call seeds its own LP engine from the segment index, as the
+    // parallel overload does, so both give the same corridor.
     inline void convexCover(const std::vector<Eigen::Vector3d> &path,
-                            const std::vector<Eigen::Vector3d> &points,
+                            const point_index::GridIndex &points,
                             const Eigen::Vector3d &lowCorner,
                             const Eigen::Vector3d &highCorner,
                             const double &progress,
                             const double &range,
                             std::vector<Eigen::MatrixX4d> &hpolys,
-                            const double eps = 1.0e-6)
+                            const double eps = 1.0e-6,
+                            std::vector<firi::FiriState> *warm = nullptr)
     {
         hpolys.clear();
         const int n = path.size();
@@ -136,8 +155,9 @@ namespace sfc_gen
         Eigen::Vector3d a, b = path[0];
         std::vector<Eigen::Vector3d> valid_pc;
         std::vector<Eigen::Vector3d> bs;
-        valid_pc.reserve(points.size());
-        for (int i = 1; i < n;)
+        Eigen::Vector3d lo, hi;
+        int seg = 0;
+        for (int i = 1; i < n; seg++)
         {
             a = b;
             if ((a - path[i]).norm() > progress)
@@ -158,31 +178,328 @@ namespace sfc_gen
             bd(4, 3) = -std::min(std::max(a(2), b(2)) + range, highCorner(2));
             bd(5, 3) = +std::max(std::min(a(2), b(2)) - range, lowCorner(2));
 
+            lo << bd(1, 3), bd(3, 3), bd(5, 3);
+            hi << -bd(0, 3), -bd(2, 3), -bd(4, 3);
             valid_pc.clear();
-            for (const Eigen::Vector3d &p : points)
+            points.query(lo, hi, valid_pc);
+            // No copy, firi takes the points by Eigen::Ref
+            Eigen::Map<const Eigen::Matrix<double, 3, -1, Eigen::ColMajor>> pc(valid_pc.empty() ? nullptr : valid_pc[0].data(), 3, valid_pc.size());
+
+            // Even seeds for the polytope of a segment, odd for its bridge
+            std::mt19937_64 gen(2 * seg);
+            if (warm != nullptr)
             {
-                if ((bd.leftCols<3>() * p + bd.rightCols<1>()).maxCoeff() < 0.0)
+                if ((int)warm->size() <= seg)
                 {
-                    valid_pc.emplace_back(p);
+                    warm->resize(seg + 1);
                 }
+                firi::firi(bd, pc, a, b, (*warm)[seg], hp, 4, 1.0e-6, &gen);
+            }
+            else
+            {
+                firi::firi(bd, pc, a, b, hp, 4, 1.0e-6, &gen);
             }
-            Eigen::Map<const Eigen::Matrix<double, 3, -1, Eigen::ColMajor>> pc(valid_pc[0].data(), 3, valid_pc.size());
-
-            firi::firi(bd, pc, a, b, hp);
 
             if (hpolys.size() != 0)
             {
                 const Eigen::Vector4d ah(a(0), a(1), a(2), 1.0);
-                if (3 <= ((hp * ah).array() > -eps).cast<int>().sum() +
-                             ((hpolys.back() * ah).array() > -eps).cast<int>().sum())
+                // Lazy products need no heap temporary for the dynamic row count
+                if (3 <= (hp.lazyProduct(ah).array() > -eps).count() +
+                             (hpolys.back().lazyProduct(ah).array() > -eps).count())
                 {
-                    firi::firi(bd, pc, a, a, gap, 1);
+                    gen.seed(2 * seg + 1);
+                    firi::firi(bd, pc, a, a, gap, 1, 1.0e-6, &gen);
                     hpolys.emplace_back(gap);
                 }
             }
 
             hpolys.emplace_back(hp);
         }
+
+        if (warm != nullptr)
+        {
+            warm->resize(seg);
+        }
+    }
+
+    inline void convexCover(const std::vector<Eigen::Vector3d> &path,
+                            const std::vector<Eigen::Vector3d> &points,
+                            const Eigen::Vector3d &lowCorner,
+                            const Eigen::Vector3d &highCorner,
+                            const double &progress,
+                            const double &range,
+                            std::vector<Eigen::MatrixX4d> &hpolys,
+                            const double eps = 1.0e-6)
+    {
+        // Indexing once is still cheaper than a full scan per segment
+        const point_index::GridIndex index(points);
+        convexCover(path, index, lowCorner, highCorner, progress, range, hpolys, eps);
+    }
+
+    // Corridor kept across map updates. build() covers the path like the
+    // parallel convexCover below and keeps every segment with its seeds,
+    // box and polytope. A polytope stays obstacle free unless a point
+    // added to the map lies inside it, so update() tests the added points
+    // against the kept polytopes and reruns FIRI only for those they hit.
+    // Bridging polytopes are redone only next to a changed polytope.
+    // Each FIRI call is seeded from its segment as in convexCover, so a
+    // regenerated polytope is the one a full rebuild would give.
+    // Removed points leave every polytope valid but no longer maximal,
+    // build() again to take back the freed space.
+    class CorridorCover
+    {
+    public:
+        inline void build(const std::vector<Eigen::Vector3d> &path,
+                          const point_index::GridIndex &points,
+                          const Eigen::Vector3d &lowCorner,
+                          const Eigen::Vector3d &highCorner,
+                          const double &progress,
+                          const double &range,
+                          std::vector<Eigen::MatrixX4d> &hpolys,
+                          const double eps = 1.0e-6,
+                          thread_pool::ThreadPool *pool = nullptr)
+        {
+            tol = eps;
+            as.clear();
+            bs.clear();
+            los.clear();
+            his.clear();
+            const int n = path.size();
+            Eigen::Vector3d a, b = path.empty() ? Eigen::Vector3d::Zero() : path[0];
+            for (int i = 1; i < n;)
+            {
+                a = b;
+                if ((a - path[i]).norm() > progress)
+                {
+                    b = (path[i] - a).normalized() * progress + a;
+                }
+                else
+                {
+                    b = path[i];
+                    i++;
+                }
+                as.emplace_back(a);
+                bs.emplace_back(b);
+                los.emplace_back((a.cwiseMin(b).array() - range).matrix().cwiseMax(lowCorner));
+                his.emplace_back((a.cwiseMax(b).array() + range).matrix().cwiseMin(highCorner));
+            }
+            const int segNum = as.size();
+
+            polys.assign(segNum, Eigen::MatrixX4d());
+            solved.assign(segNum, 0);
+            gaps.assign(segNum, Eigen::MatrixX4d());
+            bridged.assign(segNum, 0);
+            source.assign(segNum, -1);
+            std::vector<int> redo(segNum);
+            for (int k = 0; k < segNum; k++)
+            {
+                redo[k] = k;
+            }
+            regenerate(redo, points, pool);
+            std::vector<char> stale(segNum, 1);
+            assemble(stale, stale, points, pool, hpolys);
+            return;
+        }
+
+        // added holds the points put into the map since the last call and
+        // points indexes the whole updated map. Returns the number of FIRI
+        // calls made, bridging polytopes included.
+        inline int update(const Eigen::Ref<const Eigen::Matrix3Xd> &added,
+                          const point_index::GridIndex &points,
+                          std::vector<Eigen::MatrixX4d> &hpolys,
+                          thread_pool::ThreadPool *pool = nullptr)
+        {
+            const int segNum = as.size();
+            std::vector<char> polyStale(segNum, 0), gapStale(segNum, 0);
+            std::vector<int> redo;
+            if (added.cols() > 0)
+            {
+                // Polytopes lie in the boxes of their segments, so only the
+                // added points in a box are tested against its halfspaces
+                const point_index::GridIndex fresh(added);
+                std::vector<Eigen::Vector3d> near;
+                for (int k = 0; k < segNum; k++)
+                {
+                    near.clear();
+                    fresh.query(los[k], his[k], near);
+                    if (near.empty())
+                    {
+                        continue;
+                    }
+                    Eigen::Map<const Eigen::Matrix<double, 3, -1, Eigen::ColMajor>> pc(near[0].data(), 3, near.size());
+                    // A failed FIRI is retried whenever the map changes near it
+                    polyStale[k] = !solved[k] || hits(polys[k], pc);
+                    gapStale[k] = bridged[k] && hits(gaps[k], pc);
+                    if (polyStale[k])
+                    {
+                        redo.push_back(k);
+                    }
+                }
+            }
+
+            regenerate(redo, points, pool);
+            return redo.size() + assemble(polyStale, gapStale, points, pool, hpolys);
+        }
+
+        // Number of path segments, each with one polytope
+        inline int size() const
+        {
+            return as.size();
+        }
+
+    private:
+        double tol = 1.0e-6;
+        std::vector<Eigen::Vector3d> as, bs;
+        std::vector<Eigen::Vector3d> los, his;
+        std::vector<Eigen::MatrixX4d> polys, gaps;
+        std::vector<char> solved, bridged;
+        // Segment whose polytope stands for segment k, its own unless its
+        // FIRI failed, in which case the previous one is repeated
+        std::vector<int> source;
+
+        inline void box(const int k, Eigen::Matrix<double, 6, 4> &bd) const
+        {
+            bd.setZero();
+            bd(0, 0) = 1.0;
+            bd(1, 0) = -1.0;
+            bd(2, 1) = 1.0;
+            bd(3, 1) = -1.0;
+            bd(4, 2) = 1.0;
+            bd(5, 2) = -1.0;
+            bd(0, 3) = -his[k](0);
+            bd(1, 3) = los[k](0);
+            bd(2, 3) = -his[k](1);
+            bd(3, 3) = los[k](1);
+            bd(4, 3) = -his[k](2);
+            bd(5, 3) = los[k](2);
+            return;
+        }
+
+        // Whether a point lies deeper than tol inside hPoly, the same test
+        // by which firi keeps a warm started polytope
+        inline bool hits(const Eigen::MatrixX4d &hPoly,
+                         const Eigen::Ref<const Eigen::Matrix3Xd> &pc) const
+        {
+            return firi::anyInside(hPoly, pc, tol);
+        }
+
+        // FIRI for job j is segment jobs[j] >> 1, its own polytope for an
+        // even job and its bridging polytope for an odd one
+        inline void runFiri(const std::vector<int> &jobs,
+                            const point_index::GridIndex &points,
+                            thread_pool::ThreadPool *pool)
+        {
+            const auto body = [&](const int j)
+            {
+                const int k = jobs[j] >> 1;
+                const bool gap = jobs[j] & 1;
+                Eigen::Matrix<double, 6, 4> bd;
+                box(k, bd);
+                std::vector<Eigen::Vector3d> valid_pc;
+                points.query(los[k], his[k], valid_pc);
+                Eigen::Map<const Eigen::Matrix<double, 3, -1, Eigen::ColMajor>> pc(valid_pc.empty() ? nullptr : valid_pc[0].data(), 3, valid_pc.size());
+                // Own engine per job, the caller's one is left untouched
+                std::mt19937_64 gen(jobs[j]);
+                if (gap)
+                {
+                    firi::firi(bd, pc, as[k], as[k], gaps[k], 1, 1.0e-6, &gen);
+                }
+                else
+                {
+                    solved[k] = firi::firi(bd, pc, as[k], bs[k], polys[k], 4, 1.0e-6, &gen);
+                }
+            };
+            if (pool != nullptr)
+            {
+                pool->parallelFor(jobs.size(), body);
+            }
+            else
+            {
+                for (int j = 0; j < (int)jobs.size(); j++)
+                {
+                    body(j);
+                }
+            }
+            return;
+        }
+
+        inline void regenerate(const std::vector<int> &segs,
+                               const point_index::GridIndex &points,
+                               thread_pool::ThreadPool *pool)
+        {
+            std::vector<int> jobs(segs.size());
+            for (size_t j = 0; j < segs.size(); j++)
+            {
+                jobs[j] = 2 * segs[j];
+            }
+            runFiri(jobs, points, pool);
+            return;
+        }
+
+        // Redoes the gap checks, runs FIRI for the bridging polytopes that
+        // are new, next to a changed polytope or hit by an added point, and
+        // lists the corridor. Returns the number of bridging polytopes made.
+        inline int assemble(const std::vector<char> &polyStale,
+                            const std::vector<char> &gapStale,
+                            const point_index::GridIndex &points,
+                            thread_pool::ThreadPool *pool,
+                            std::vector<Eigen::MatrixX4d> &hpolys)
+        {
+            const int segNum = as.size();
+            std::vector<char> moved(segNum);
+            for (int k = 0; k < segNum; k++)
+            {
+                const int src = (k == 0 || solved[k]) ? k : source[k - 1];
+                moved[k] = src != source[k] || polyStale[src];
+                source[k] = src;
+            }
+
+            std::vector<int> jobs;
+            for (int k = 1; k < segNum; k++)
+            {
+                const Eigen::Vector4d ah(as[k](0), as[k](1), as[k](2), 1.0);
+                const bool need = 3 <= (polys[source[k]].lazyProduct(ah).array() > -tol).count() +
+                                           (polys[source[k - 1]].lazyProduct(ah).array() > -tol).count();
+                if (need && (!bridged[k] || moved[k] || moved[k - 1] || gapStale[k]))
+                {
+                    jobs.push_back(2 * k + 1);
+                }
+                bridged[k] = need;
+            }
+            runFiri(jobs, points, pool);
+
+            hpolys.clear();
+            for (int k = 0; k < segNum; k++)
+            {
+                if (bridged[k])
+                {
+                    hpolys.emplace_back(gaps[k]);
+                }
+                hpolys.emplace_back(polys[source[k]]);
+            }
+            return jobs.size();
+        }
+    };
+
+    // Parallel convexCover: the segments are cut first, FIRI runs for all of
+    // them on pool, then the gap checks follow in path order and the
+    // bridging polytopes they call for run on pool as well, giving the same
+    // polytope sequence as the sequential pass.
+    // Each FIRI call seeds its own LP engine from the segment index, so the
+    // corridor does not depend on the number of threads.
+    inline void convexCover(const std::vector<Eigen::Vector3d> &path,
+                            const point_index::GridIndex &points,
+                            const Eigen::Vector3d &lowCorner,
+                            const Eigen::Vector3d &highCorner,
+                            const double &progress,
+                            const double &range,
+                            thread_pool::ThreadPool &pool,
+                            std::vector<Eigen::MatrixX4d> &hpolys,
+                            const double eps = 1.0e-6)
+    {
+        CorridorCover cover;
+        cover.build(path, points, lowCorner, highCorner, progress, range, hpolys, eps, &pool);
+        return;
     }
 
     inline void shortCut(std::vector<Eigen::MatrixX4d> &hpolys)
@@ -196,29 +513,64 @@ namespace sfc_gen
         hpolys.clear();
 
         int M = htemp.size();
-        Eigen::MatrixX4d hPoly;
-        bool overlap;
         std::deque<int> idices;
         idices.push_front(M - 1);
-        for (int i = M - 1; i >= 0; i--)
+
+        // Polytopes with disjoint bounding boxes cannot overlap, which
+        // settles most far pairs without their overlap LP. The boxes are
+        // padded so that LP round-off never rejects a true overlap.
+        std::vector<Eigen::Vector3d> lo(M), hi(M);
+        for (int k = 0; k < M; k++)
+        {
+            geo_utils::boundingBox(htemp[k], lo[k], hi[k]);
+            lo[k].array() -= 1.0e-6;
+            hi[k].array() += 1.0e-6;
+        }
+
+        // Sweep the boxes in order of their lower x bound, keeping those
+        // not yet passed in x, so that only pairs of intersecting boxes
+        // are ever compared. near[i] gets every such j < i.
+        std::vector<int> order(M);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](const int a, const int b)
+                  { return lo[a](0) < lo[b](0); });
+        std::vector<std::vector<int>> near(M);
+        std::vector<int> active;
+        for (const int k : order)
         {
-            for (int j = 0; j < i; j++)
+            active.erase(std::remove_if(active.begin(), active.end(), [&](const int a)
+                                        { return hi[a](0) <= lo[k](0); }),
+                         active.end());
+            for (const int a : active)
             {
-                if (j < i - 1)
+                if ((lo[a].array() < hi[k].array()).all() &&
+                    (lo[k].array() < hi[a].array()).all())
                 {
-                    overlap = geo_utils::overlap(htemp[i], htemp[j], 0.01);
+                    near[std::max(a, k)].push_back(std::min(a, k));
                 }
-                else
+            }
+            active.push_back(k);
+        }
+
+        // The furthest polytope back that overlaps i, its neighbour if none
+        for (int i = M - 1; i > 0;)
+        {
+            std::sort(near[i].begin(), near[i].end());
+            int j = i - 1;
+            for (const int k : near[i])
+            {
+                if (k >= i - 1)
                 {
-                    overlap = true;
+                    break;
                 }
-                if (overlap)
+                if (geo_utils::overlap(htemp[i], htemp[k], 0.01))
                 {
-                    idices.push_front(j);
-                    i = j + 1;
+                    j = k;
                     break;
                 }
             }
+            idices.push_front(j);
+            i = j;
         }
         for (const auto &ele : idices)
         {
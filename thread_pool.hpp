@@ -0,0 +1,275 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace thread_pool
+{
+
+    // A fixed set of workers, each owning a task deque.
+    // Workers pop their own deque from the back and steal from
+    // the front of the others, so a long task only blocks the
+    // worker running it while the rest of the queue drains.
+    class ThreadPool
+    {
+    public:
+        typedef std::function<void()> Task;
+
+        explicit ThreadPool(int threadNum = 0)
+        {
+            if (threadNum <= 0)
+            {
+                threadNum = std::max(1, (int)std::thread::hardware_concurrency());
+            }
+            queues.reserve(threadNum);
+            for (int i = 0; i < threadNum; i++)
+            {
+                queues.emplace_back(new WorkQueue());
+            }
+            workers.reserve(threadNum);
+            for (int i = 0; i < threadNum; i++)
+            {
+                workers.emplace_back(&ThreadPool::workerLoop, this, i);
+            }
+        }
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                stopping = true;
+            }
+            sleepCond.notify_all();
+            for (auto &w : workers)
+            {
+                w.join();
+            }
+        }
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        inline int size() const
+        {
+            return workers.size();
+        }
+
+        // Index of the calling worker in this pool, -1 for other threads
+        inline int workerIndex() const
+        {
+            return currentPool() == this ? currentIndex() : -1;
+        }
+
+        // Tasks submitted from a worker go to its own deque,
+        // others are distributed round robin
+        inline void post(Task task)
+        {
+            int idx = workerIndex();
+            if (idx < 0)
+            {
+                idx = nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+            }
+            {
+                std::lock_guard<std::mutex> lock(queues[idx]->mutex);
+                queues[idx]->tasks.push_back(std::move(task));
+            }
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                pending++;
+            }
+            sleepCond.notify_one();
+            return;
+        }
+
+        template <typename F>
+        inline auto submit(F &&func) -> std::future<typename std::invoke_result<F>::type>
+        {
+            typedef typename std::invoke_result<F>::type R;
+            auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(func));
+            std::future<R> result = task->get_future();
+            post([task]()
+                 { (*task)(); });
+            return result;
+        }
+
+        // Calls func(i) for i in [0, n). The calling thread takes part in
+        // the loop, so it is safe to call from inside a worker as well.
+        // Once func throws, the indices not yet started are skipped and
+        // the first exception is rethrown here after the loop drains.
+        template <typename F>
+        inline void parallelFor(const int n, const F &func)
+        {
+            if (n <= 0)
+            {
+                return;
+            }
+            struct LoopState
+            {
+                std::atomic<int> next{0};
+                std::atomic<int> done{0};
+                std::atomic<bool> failed{false};
+                std::exception_ptr error;
+                std::mutex mutex;
+                std::condition_variable cond;
+            };
+            const auto state = std::make_shared<LoopState>();
+            const auto body = [state, n, &func]()
+            {
+                int i, count = 0;
+                while ((i = state->next.fetch_add(1)) < n)
+                {
+                    // A throwing index still counts as done, or the
+                    // caller would wait for it forever
+                    if (!state->failed.load())
+                    {
+                        try
+                        {
+                            func(i);
+                        }
+                        catch (...)
+                        {
+                            std::lock_guard<std::mutex> lock(state->mutex);
+                            if (!state->error)
+                            {
+                                state->error = std::current_exception();
+                            }
+                            state->failed.store(true);
+                        }
+                    }
+                    count++;
+                }
+                if (count > 0 && state->done.fetch_add(count) + count == n)
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    state->cond.notify_all();
+                }
+            };
+
+            // Helpers that start after the loop is exhausted do nothing,
+            // they only keep the shared state alive, never func itself
+            const int helpers = std::min(n, size() + 1) - 1;
+            for (int k = 0; k < helpers; k++)
+            {
+                post([state, n, &func, body]()
+                     {
+                         if (state->next.load() < n)
+                         {
+                             body();
+                         } });
+            }
+            body();
+
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->cond.wait(lock, [&]()
+                             { return state->done.load() == n; });
+            if (state->error)
+            {
+                std::rethrow_exception(state->error);
+            }
+            return;
+        }
+
+    private:
+        struct WorkQueue
+        {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        std::vector<std::unique_ptr<WorkQueue>> queues;
+        std::vector<std::thread> workers;
+        std::atomic<unsigned> nextQueue{0};
+
+        std::mutex sleepMutex;
+        std::condition_variable sleepCond;
+        int pending = 0;
+        bool stopping = false;
+
+        static inline const ThreadPool *&currentPool()
+        {
+            thread_local const ThreadPool *pool = nullptr;
+            return pool;
+        }
+
+        static inline int &currentIndex()
+        {
+            thread_local int index = -1;
+            return index;
+        }
+
+        inline bool popLocal(const int idx, Task &task)
+        {
+            WorkQueue &q = *queues[idx];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (q.tasks.empty())
+            {
+                return false;
+            }
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+            return true;
+        }
+
+        inline bool steal(const int idx, Task &task)
+        {
+            const int n = queues.size();
+            for (int k = 1; k < n; k++)
+            {
+                WorkQueue &q = *queues[(idx + k) % n];
+                std::lock_guard<std::mutex> lock(q.mutex);
+                if (!q.tasks.empty())
+                {
+                    task = std::move(q.tasks.front());
+                    q.tasks.pop_front();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        inline void workerLoop(const int idx)
+        {
+            currentPool() = this;
+            currentIndex() = idx;
+
+            Task task;
+            while (true)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(sleepMutex);
+                    sleepCond.wait(lock, [this]()
+                                   { return pending > 0 || stopping; });
+                    if (pending == 0 && stopping)
+                    {
+                        break;
+                    }
+                    pending--;
+                }
+                // A pending count guarantees one task somewhere,
+                // though another worker may grab it first; keep looking
+                while (!popLocal(idx, task) && !steal(idx, task))
+                {
+                    std::this_thread::yield();
+                }
+                task();
+                task = nullptr;
+            }
+            return;
+        }
+    };
+
+}
+
+#endif
@@ -0,0 +1,551 @@
+#ifndef VOXEL_MAP_HPP
+#define VOXEL_MAP_HPP
+
+#include <Eigen/Eigen>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace voxel_map
+{
+
+    // Occupancy grid with one bit per voxel, usable as the Map of
+    // sfc_gen::planPath. Each x row is stored in whole 64-bit words, so
+    // that neighbours along y and z are word operations.
+    // Two layers are kept: the occupied voxels as inserted, and the blocked
+    // voxels, which are the occupied ones inflated by a box of the given
+    // radius in voxels. query and raycast only look at the blocked layer,
+    // and anything outside the map is treated as blocked.
+    class VoxelMap
+    {
+    public:
+        VoxelMap() = default;
+
+        VoxelMap(const Eigen::Vector3i &size,
+                 const Eigen::Vector3d &origin,
+                 const double scale,
+                 const int inflation = 0)
+        {
+            setup(size, origin, scale, inflation);
+        }
+
+        // origin is the minimum corner of voxel (0, 0, 0)
+        inline void setup(const Eigen::Vector3i &size,
+                          const Eigen::Vector3d &origin,
+                          const double scale,
+                          const int inflation = 0)
+        {
+            mapSize = size.cwiseMax(1);
+            mapOrigin = origin;
+            voxScale = scale;
+            invScale = 1.0 / scale;
+            radius = std::max(0, inflation);
+            rowWords = (mapSize(0) + 63) / 64;
+            rowNum = mapSize(1) * mapSize(2);
+            occ.assign((size_t)rowNum * rowWords, 0);
+            blk.assign((size_t)rowNum * rowWords, 0);
+            return;
+        }
+
+        inline void clear()
+        {
+            std::fill(occ.begin(), occ.end(), 0);
+            std::fill(blk.begin(), blk.end(), 0);
+            return;
+        }
+
+        // 0 for a free voxel, 1 for a blocked one or a point off the map
+        inline int query(const Eigen::Vector3d &pos) const
+        {
+            Eigen::Vector3i id;
+            return locate(pos, id) ? query(id(0), id(1), id(2)) : 1;
+        }
+
+        inline int query(const int x, const int y, const int z) const
+        {
+            if ((unsigned)x >= (unsigned)mapSize(0) ||
+                (unsigned)y >= (unsigned)mapSize(1) ||
+                (unsigned)z >= (unsigned)mapSize(2))
+            {
+                return 1;
+            }
+            return (blk[word(x, y, z)] >> (x & 63)) & 1;
+        }
+
+        // Marks the voxel of p as occupied and blocks the box of the
+        // inflation radius around it. Points off the map are skipped.
+        inline void insert(const Eigen::Vector3d &p)
+        {
+            Eigen::Vector3i id;
+            if (!locate(p, id))
+            {
+                return;
+            }
+            uint64_t &w = occ[word(id(0), id(1), id(2))];
+            const uint64_t bit = uint64_t(1) << (id(0) & 63);
+            if (w & bit)
+            {
+                return;
+            }
+            w |= bit;
+
+            const Eigen::Vector3i lo = (id.array() - radius).cwiseMax(0);
+            const Eigen::Vector3i hi = (id.array() + radius).cwiseMin(mapSize.array() - 1);
+            for (int z = lo(2); z <= hi(2); z++)
+            {
+                for (int y = lo(1); y <= hi(1); y++)
+                {
+                    setSpan(&blk[row(y, z)], lo(0), hi(0));
+                }
+            }
+            return;
+        }
+
+        inline void insert(const std::vector<Eigen::Vector3d> &points)
+        {
+            for (const Eigen::Vector3d &p : points)
+            {
+                insert(p);
+            }
+            return;
+        }
+
+        inline void insert(const Eigen::Ref<const Eigen::Matrix3Xd> &points)
+        {
+            for (int i = 0; i < points.cols(); i++)
+            {
+                insert(Eigen::Vector3d(points.col(i)));
+            }
+            return;
+        }
+
+        // Rebuilds the blocked layer for a new inflation radius
+        inline void setInflation(const int inflation)
+        {
+            radius = std::max(0, inflation);
+            std::fill(blk.begin(), blk.end(), 0);
+            dilate(Eigen::Vector3i::Zero(), mapSize.array() - 1);
+            return;
+        }
+
+        // Walks the voxels crossed by the segment in order. Returns true
+        // if none is blocked, otherwise false with hit set to the point
+        // where the segment enters the first blocked voxel, or leaves the
+        // map. A non-finite end counts as blocked at from.
+        inline bool raycast(const Eigen::Vector3d &from,
+                            const Eigen::Vector3d &to,
+                            Eigen::Vector3d *hit = nullptr) const
+        {
+            const Eigen::Vector3d s = (from - mapOrigin) * invScale;
+            const Eigen::Vector3d dir = (to - from) * invScale;
+            Eigen::Vector3i id;
+            if (!locate(from, id) || !dir.allFinite())
+            {
+                if (hit != nullptr)
+                {
+                    *hit = from;
+                }
+                return false;
+            }
+
+            // A far end is clipped to the map in double, before its voxel
+            // is cast to int
+            Eigen::Vector3i last;
+            const bool inside = locate(to, last);
+            double tEnd = 1.0;
+            if (!inside)
+            {
+                for (int k = 0; k < 3; k++)
+                {
+                    if (dir(k) > 0.0)
+                    {
+                        tEnd = std::min(tEnd, (mapSize(k) - s(k)) / dir(k));
+                    }
+                    else if (dir(k) < 0.0)
+                    {
+                        tEnd = std::min(tEnd, -s(k) / dir(k));
+                    }
+                }
+                last = (s + tEnd * dir).array().floor().cwiseMax(0.0).cwiseMin(mapSize.cast<double>().array() - 1.0).cast<int>();
+            }
+
+            Eigen::Vector3i step;
+            Eigen::Vector3d tMax, tDelta;
+            for (int k = 0; k < 3; k++)
+            {
+                if (dir(k) > 0.0)
+                {
+                    step(k) = 1;
+                    tDelta(k) = 1.0 / dir(k);
+                    tMax(k) = (id(k) + 1.0 - s(k)) * tDelta(k);
+                }
+                else if (dir(k) < 0.0)
+                {
+                    step(k) = -1;
+                    tDelta(k) = -1.0 / dir(k);
+                    tMax(k) = (s(k) - id(k)) * tDelta(k);
+                }
+                else
+                {
+                    step(k) = 0;
+                    tDelta(k) = INFINITY;
+                    tMax(k) = INFINITY;
+                }
+            }
+
+            // The walk crosses exactly this many voxel faces
+            const int steps = (last - id).cwiseAbs().sum();
+            double t = 0.0;
+            for (int i = 0;; i++)
+            {
+                if (query(id(0), id(1), id(2)))
+                {
+                    if (hit != nullptr)
+                    {
+                        *hit = from + t * (to - from);
+                    }
+                    return false;
+                }
+                if (i == steps)
+                {
+                    break;
+                }
+                int k;
+                tMax.minCoeff(&k);
+                t = tMax(k);
+                id(k) += step(k);
+                tMax(k) += tDelta(k);
+            }
+            if (!inside)
+            {
+                if (hit != nullptr)
+                {
+                    *hit = from + tEnd * (to - from);
+                }
+                return false;
+            }
+            return true;
+        }
+
+        // Centres of all occupied voxels, before inflation
+        inline void getOccupied(std::vector<Eigen::Vector3d> &points) const
+        {
+            points.clear();
+            for (int z = 0; z < mapSize(2); z++)
+            {
+                for (int y = 0; y < mapSize(1); y++)
+                {
+                    appendCenters(&occ[row(y, z)], y, z, points);
+                }
+            }
+            return;
+        }
+
+        // Centres of the blocked voxels with a free face neighbour, which
+        // are the only ones that can bound a polytope grown in free space.
+        // The result is meant as the points input of sfc_gen::convexCover.
+        inline void getSurface(std::vector<Eigen::Vector3d> &points) const
+        {
+            points.clear();
+            // Voxels off the map count as blocked neighbours
+            const std::vector<uint64_t> full(rowWords, ~uint64_t(0));
+            std::vector<uint64_t> ext(rowWords), surf(rowWords);
+            for (int z = 0; z < mapSize(2); z++)
+            {
+                for (int y = 0; y < mapSize(1); y++)
+                {
+                    const uint64_t *b = &blk[row(y, z)];
+                    const uint64_t *ym = y > 0 ? &blk[row(y - 1, z)] : full.data();
+                    const uint64_t *yp = y + 1 < mapSize(1) ? &blk[row(y + 1, z)] : full.data();
+                    const uint64_t *zm = z > 0 ? &blk[row(y, z - 1)] : full.data();
+                    const uint64_t *zp = z + 1 < mapSize(2) ? &blk[row(y, z + 1)] : full.data();
+                    std::copy(b, b + rowWords, ext.begin());
+                    ext[rowWords - 1] |= ~lastMask();
+                    uint64_t carry = 1;
+                    for (int w = 0; w < rowWords; w++)
+                    {
+                        const uint64_t xm = (ext[w] << 1) | carry;
+                        const uint64_t xp = (ext[w] >> 1) |
+                                            (w + 1 < rowWords ? ext[w + 1] << 63 : uint64_t(1) << 63);
+                        carry = ext[w] >> 63;
+                        surf[w] = b[w] & ~(xm & xp & ym[w] & yp[w] & zm[w] & zp[w]);
+                    }
+                    appendCenters(surf.data(), y, z, points);
+                }
+            }
+            return;
+        }
+
+        // Recentres a window of fixed size at center. Voxels that stay in
+        // the window are kept. Those entering it have no occupied voxels,
+        // but the ones within the inflation radius of the kept part are
+        // blocked again from it. The origin moves by whole voxels, so the
+        // memory held never changes. A non-finite center is ignored.
+        inline void slide(const Eigen::Vector3d &center)
+        {
+            // The shift is found in double and only cast once it is cut to
+            // the window size, past which the whole window is replaced
+            const Eigen::Array3d moved = ((center - mapOrigin) * invScale).array().floor() -
+                                         Eigen::Array3d(mapSize(0) / 2, mapSize(1) / 2, mapSize(2) / 2);
+            if (!moved.allFinite() || (moved == 0.0).all())
+            {
+                return;
+            }
+            const Eigen::Array3d size = mapSize.cast<double>().array();
+            const Eigen::Vector3i shift = moved.cwiseMax(-size).cwiseMin(size).cast<int>();
+            shiftLayer(shift, occ);
+            shiftLayer(shift, blk);
+            mapOrigin += moved.matrix() * voxScale;
+
+            // Entering slab of each axis, cut to the band next to the kept part
+            for (int k = 0; k < 3 && radius > 0; k++)
+            {
+                const int s = shift(k);
+                if (s == 0 || std::abs(s) >= mapSize(k))
+                {
+                    continue;
+                }
+                Eigen::Vector3i lo = Eigen::Vector3i::Zero();
+                Eigen::Vector3i hi = mapSize.array() - 1;
+                if (s > 0)
+                {
+                    lo(k) = mapSize(k) - s;
+                    hi(k) = std::min(mapSize(k) - 1, lo(k) + radius - 1);
+                }
+                else
+                {
+                    hi(k) = -s - 1;
+                    lo(k) = std::max(0, hi(k) - radius + 1);
+                }
+                dilate(lo, hi);
+            }
+            return;
+        }
+
+        inline const Eigen::Vector3i &getSize() const
+        {
+            return mapSize;
+        }
+
+        inline const Eigen::Vector3d &getOrigin() const
+        {
+            return mapOrigin;
+        }
+
+        inline Eigen::Vector3d getCorner() const
+        {
+            return mapOrigin + mapSize.cast<double>() * voxScale;
+        }
+
+        inline double getScale() const
+        {
+            return voxScale;
+        }
+
+        inline int getInflation() const
+        {
+            return radius;
+        }
+
+    private:
+        Eigen::Vector3i mapSize = Eigen::Vector3i::Ones();
+        Eigen::Vector3d mapOrigin = Eigen::Vector3d::Zero();
+        double voxScale = 1.0;
+        double invScale = 1.0;
+        int radius = 0;
+        int rowWords = 1;
+        int rowNum = 1;
+        std::vector<uint64_t> occ = std::vector<uint64_t>(1, 0);
+        std::vector<uint64_t> blk = std::vector<uint64_t>(1, 0);
+        std::vector<uint64_t> scratch, dilated;
+
+        // Voxel of p, or false when p is off the map or NaN. The bounds are
+        // checked in double since the int cast of a far-off p overflows.
+        inline bool locate(const Eigen::Vector3d &p, Eigen::Vector3i &id) const
+        {
+            const Eigen::Array3d f = ((p - mapOrigin) * invScale).array().floor();
+            if (!((f >= 0.0).all() && (f < mapSize.cast<double>().array()).all()))
+            {
+                return false;
+            }
+            id = f.cast<int>();
+            return true;
+        }
+
+        inline size_t row(const int y, const int z) const
+        {
+            return ((size_t)z * mapSize(1) + y) * rowWords;
+        }
+
+        inline size_t word(const int x, const int y, const int z) const
+        {
+            return row(y, z) + (x >> 6);
+        }
+
+        // Valid bits of the last word of a row
+        inline uint64_t lastMask() const
+        {
+            const int tail = mapSize(0) & 63;
+            return tail == 0 ? ~uint64_t(0) : (uint64_t(1) << tail) - 1;
+        }
+
+        // Sets bits x0 to x1 of a row, both inclusive
+        static inline void setSpan(uint64_t *b, const int x0, const int x1)
+        {
+            const int w0 = x0 >> 6, w1 = x1 >> 6;
+            const uint64_t m0 = ~uint64_t(0) << (x0 & 63);
+            const uint64_t m1 = ~uint64_t(0) >> (63 - (x1 & 63));
+            if (w0 == w1)
+            {
+                b[w0] |= m0 & m1;
+                return;
+            }
+            b[w0] |= m0;
+            for (int w = w0 + 1; w < w1; w++)
+            {
+                b[w] = ~uint64_t(0);
+            }
+            b[w1] |= m1;
+            return;
+        }
+
+        inline void appendCenters(const uint64_t *b, const int y, const int z,
+                                  std::vector<Eigen::Vector3d> &points) const
+        {
+            for (int w = 0; w < rowWords; w++)
+            {
+                for (uint64_t bits = b[w]; bits != 0; bits &= bits - 1)
+                {
+                    const int x = 64 * w + __builtin_ctzll(bits);
+                    points.emplace_back(mapOrigin(0) + (x + 0.5) * voxScale,
+                                        mapOrigin(1) + (y + 0.5) * voxScale,
+                                        mapOrigin(2) + (z + 0.5) * voxScale);
+                }
+            }
+            return;
+        }
+
+        // ORs into blk the inflation of occ over the voxels from lo to hi.
+        // The box dilation is separable, so it is done one axis at a time,
+        // on the rows and words that reach the box. Voxels outside the box
+        // may get only part of their inflation, which the OR leaves harmless.
+        inline void dilate(const Eigen::Vector3i &lo, const Eigen::Vector3i &hi)
+        {
+            const Eigen::Vector3i slo = (lo.array() - radius).cwiseMax(0);
+            const Eigen::Vector3i shi = (hi.array() + radius).cwiseMin(mapSize.array() - 1);
+            const int w0 = slo(0) >> 6, w1 = shi(0) >> 6;
+            scratch.resize(occ.size());
+            dilated.resize(occ.size());
+
+            // Along x, one voxel per pass with the carries between words
+            for (int z = slo(2); z <= shi(2); z++)
+            {
+                for (int y = slo(1); y <= shi(1); y++)
+                {
+                    const uint64_t *o = &occ[row(y, z)];
+                    uint64_t *b = &scratch[row(y, z)];
+                    std::copy(o + w0, o + w1 + 1, b + w0);
+                    for (int k = 0; k < radius; k++)
+                    {
+                        uint64_t carry = 0;
+                        for (int w = w0; w <= w1; w++)
+                        {
+                            const uint64_t cur = b[w];
+                            const uint64_t next = w < w1 ? b[w + 1] : 0;
+                            b[w] = cur | (cur << 1) | carry | (cur >> 1) | (next << 63);
+                            carry = cur >> 63;
+                        }
+                    }
+                    if (w1 == rowWords - 1)
+                    {
+                        b[w1] &= lastMask();
+                    }
+                }
+            }
+
+            // Along y, OR of whole rows
+            for (int z = slo(2); z <= shi(2); z++)
+            {
+                for (int y = lo(1); y <= hi(1); y++)
+                {
+                    uint64_t *dst = &dilated[row(y, z)];
+                    std::fill(dst + w0, dst + w1 + 1, 0);
+                    const int s0 = std::max(0, y - radius);
+                    const int s1 = std::min(mapSize(1) - 1, y + radius);
+                    for (int s = s0; s <= s1; s++)
+                    {
+                        const uint64_t *src = &scratch[row(s, z)];
+                        for (int w = w0; w <= w1; w++)
+                        {
+                            dst[w] |= src[w];
+                        }
+                    }
+                }
+            }
+
+            // Along z, OR of whole rows into blk
+            for (int z = lo(2); z <= hi(2); z++)
+            {
+                const int s0 = std::max(0, z - radius);
+                const int s1 = std::min(mapSize(2) - 1, z + radius);
+                for (int y = lo(1); y <= hi(1); y++)
+                {
+                    uint64_t *dst = &blk[row(y, z)];
+                    for (int s = s0; s <= s1; s++)
+                    {
+                        const uint64_t *src = &dilated[row(y, s)];
+                        for (int w = w0; w <= w1; w++)
+                        {
+                            dst[w] |= src[w];
+                        }
+                    }
+                }
+            }
+            return;
+        }
+
+        // layer(x, y, z) becomes layer(x + s(0), y + s(1), z + s(2)),
+        // with zeros where that is off the map
+        inline void shiftLayer(const Eigen::Vector3i &s,
+                               std::vector<uint64_t> &layer)
+        {
+            scratch.assign(layer.size(), 0);
+            // Word and bit offsets of the x shift, rounded down
+            const int q = s(0) >= 0 ? s(0) / 64 : -((63 - s(0)) / 64);
+            const int r = s(0) - 64 * q;
+            for (int z = 0; z < mapSize(2); z++)
+            {
+                const int sz = z + s(2);
+                if (sz < 0 || sz >= mapSize(2))
+                {
+                    continue;
+                }
+                for (int y = 0; y < mapSize(1); y++)
+                {
+                    const int sy = y + s(1);
+                    if (sy < 0 || sy >= mapSize(1))
+                    {
+                        continue;
+                    }
+                    const uint64_t *src = &layer[row(sy, sz)];
+                    uint64_t *dst = &scratch[row(y, z)];
+                    for (int w = 0; w < rowWords; w++)
+                    {
+                        const int w0 = w + q;
+                        const uint64_t lo = w0 >= 0 && w0 < rowWords ? src[w0] : 0;
+                        const uint64_t hi = w0 + 1 >= 0 && w0 + 1 < rowWords ? src[w0 + 1] : 0;
+                        dst[w] = r == 0 ? lo : (lo >> r) | (hi << (64 - r));
+                    }
+                    dst[rowWords - 1] &= lastMask();
+                }
+            }
+            std::swap(layer, scratch);
+            return;
+        }
+    };
+
+}
+
+#endif